@@ -0,0 +1,791 @@
+// Host benchmark: runs the driver and the stack against the simulated
+// ENC28J60 and reports the SPI traffic and time per received frame, and
+// the time of the checksum against the plain 16-bit loop.
+// Every answer the stack sends is checked, the exit code is 1 if one is
+// missing or wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "enc28j60.h"
+#include "enc28j60_sim.h"
+#include "ip_arp_udp_tcp.h"
+#include "net.h"
+
+#define BUFFER_SIZE 1518
+#define FRAMES 2000
+
+static uint8_t mymac[6] = {0x54, 0x55, 0x58, 0x10, 0x00, 0x24};
+static uint8_t myip[4] = {192, 168, 1, 25};
+static uint8_t peermac[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+static uint8_t peerip[4] = {192, 168, 1, 1};
+
+static struct enc28j60_sim sim;
+static uint8_t buf[BUFFER_SIZE + 1];
+
+// the frame the stack should answer with and how many answers were right
+static const uint8_t *expect;
+static uint16_t expectLen;
+static uint32_t replies, bad;
+
+// The checksums of the frames built here and the reference for
+// checksums(): the 16-bit loop checksum() of the stack had before the
+// 32-bit kernel, type as there.
+static uint16_t csum(const uint8_t *p, uint16_t len, uint8_t type)
+{
+	uint32_t sum = 0;
+
+	if (type == 1)
+		sum += IP_PROTO_UDP_V + len - 8;
+	if (type == 2)
+		sum += IP_PROTO_TCP_V + len - 8;
+	for (; len > 1; p += 2, len -= 2)
+		sum += ((uint16_t)p[0] << 8) | p[1];
+	if (len)
+		sum += (uint16_t)p[0] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum & 0xffff;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static uint16_t build_arp(uint8_t *f, uint8_t op, const uint8_t *dmac, const uint8_t *smac,
+		const uint8_t *sip, const uint8_t *tmac, const uint8_t *tip)
+{
+	static const uint8_t hdr[] = {0, 1, 8, 0, 6, 4, 0};
+
+	memcpy(f, dmac, 6);
+	memcpy(f + 6, smac, 6);
+	f[12] = ETHTYPE_ARP_H_V;
+	f[13] = ETHTYPE_ARP_L_V;
+	memcpy(f + 14, hdr, sizeof(hdr));
+	f[21] = op;
+	memcpy(f + 22, smac, 6);
+	memcpy(f + 28, sip, 4);
+	memcpy(f + 32, tmac, 6);
+	memcpy(f + 38, tip, 4);
+	return 42;
+}
+
+static uint16_t build_ip(uint8_t *f, const uint8_t *dmac, const uint8_t *smac,
+		const uint8_t *sip, const uint8_t *dip, uint8_t proto, uint16_t l4len)
+{
+	memcpy(f, dmac, 6);
+	memcpy(f + 6, smac, 6);
+	f[12] = ETHTYPE_IP_H_V;
+	f[13] = ETHTYPE_IP_L_V;
+	memset(f + 14, 0, 20);
+	f[14] = 0x45;
+	put16(f + 16, 20 + l4len);
+	f[22] = 64;
+	f[23] = proto;
+	memcpy(f + 26, sip, 4);
+	memcpy(f + 30, dip, 4);
+	put16(f + 24, csum(f + 14, 20, 0));
+	return 34 + l4len;
+}
+
+// the stack sends its ip packets with don't fragment
+static void set_df(uint8_t *f)
+{
+	f[20] = 0x40;
+	put16(f + 24, 0);
+	put16(f + 24, csum(f + 14, 20, 0));
+}
+
+static uint16_t build_echo(uint8_t *f, uint8_t type, const uint8_t *dmac, const uint8_t *smac,
+		const uint8_t *sip, const uint8_t *dip, uint16_t payload)
+{
+	uint16_t i, len = build_ip(f, dmac, smac, sip, dip, IP_PROTO_ICMP_V, 8 + payload);
+
+	f[34] = type;
+	f[35] = 0;
+	f[36] = f[37] = 0;
+	put16(f + 38, 0x1234);
+	put16(f + 40, 1);
+	for (i = 0; i < payload; i++)
+		f[42 + i] = i;
+	put16(f + 36, csum(f + 34, 8 + payload, 0));
+	return len;
+}
+
+static void capture(struct enc28j60_sim *s, const uint8_t *frame, uint16_t len)
+{
+	(void)s;
+	replies++;
+	// the chip pads short frames to 60 bytes
+	if (expect == NULL || len < expectLen || memcmp(frame, expect, expectLen) != 0)
+		bad++;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The EXTI handler of the INT pin in ETHERNET_INT_RX mode, called while the
+// pin is asserted. The simulated chip has no timing, the bench serves the
+// pin after every frame from the wire and every receive call.
+static void irq(void)
+{
+#if ETHERNET_INT_RX
+	uint32_t i;
+
+	for (i = 0; i < 8 && enc28j60SimIntPending(&sim); i++)
+		enc28j60IrqHandler();
+#endif
+}
+
+// a frame arriving from the wire
+static uint8_t inject(const uint8_t *frame, uint16_t len)
+{
+	uint8_t ok = enc28j60SimInject(&sim, frame, len);
+
+	irq();
+	return ok;
+}
+
+static uint16_t receive_plain(void)
+{
+	uint16_t plen = enc28j60PacketReceive(BUFFER_SIZE, buf);
+
+	if (plen)
+		packetloop_icmp_tcp(buf, plen);
+	irq();
+	return plen;
+}
+
+static uint16_t receive_fastpath(void)
+{
+	uint16_t plen = packet_receive_fastpath(buf, BUFFER_SIZE);
+
+	if (plen)
+		packetloop_icmp_tcp(buf, plen);
+	irq();
+	return plen;
+}
+
+#if ETHERNET_CSUM_RX_VERIFY
+// udp for us with olen bytes of ip options (NOPs), without a udp checksum
+// if nocsum
+static uint16_t build_udp_opts(uint8_t *f, uint8_t olen, uint16_t payload, uint8_t nocsum)
+{
+	static uint8_t ph[BUFFER_SIZE];
+	uint16_t i, l4len = 8 + payload;
+	uint16_t len = build_ip(f, mymac, peermac, peerip, myip, IP_PROTO_UDP_V, olen + l4len);
+	uint8_t *u = f + 34 + olen;
+
+	f[14] = 0x45 + olen / 4;
+	memset(f + 34, 1, olen);
+	put16(f + 24, 0);
+	put16(f + 24, csum(f + 14, 20 + olen, 0));
+	put16(u, 1234);
+	put16(u + 2, 5678);
+	put16(u + 4, l4len);
+	put16(u + 6, 0);
+	for (i = 0; i < payload; i++)
+		u[8 + i] = i;
+	if (!nocsum) {
+		// the pseudo header: ip.src, ip.dst and the segment
+		memcpy(ph, f + 26, 8);
+		memcpy(ph + 8, u, l4len);
+		put16(u + 6, csum(ph, 8 + l4len, 1));
+	}
+	return len;
+}
+
+// Udp frames with ip options through enc28j60PacketReceive and
+// enc28j60RxHead: good ones and ones without a checksum get through, a
+// corrupted one is dropped.
+static int checksumOptions(void)
+{
+	static const uint8_t olens[] = { 4, 40 };
+	static uint8_t f[BUFFER_SIZE];
+	struct enc28j60_stats st;
+	uint16_t len, got;
+	uint8_t o, kind, path, want;
+	uint32_t errors;
+	int ok = 1;
+
+	for (o = 0; o < sizeof(olens); o++) {
+		for (kind = 0; kind < 3; kind++) {
+			for (path = 0; path < 2; path++) {
+				len = build_udp_opts(f, olens[o], 100, kind == 1);
+				if (kind == 2)
+					f[len - 1] ^= 0xff;
+				want = kind != 2;
+				enc28j60GetStats(&st);
+				errors = st.rxCsumErrors;
+				inject(f, len);
+				if (path == 0) {
+					got = enc28j60PacketReceive(BUFFER_SIZE, buf);
+				} else {
+					got = enc28j60RxHead(ICMP_DATA_P, buf);
+					if (got)
+						enc28j60RxFinish();
+				}
+				enc28j60GetStats(&st);
+				if ((got == len) != want || (st.rxCsumErrors - errors) != !want) {
+					printf("udp with %u bytes of ip options, %s, %s: FAIL\n", olens[o],
+						kind == 0 ? "checksum" : kind == 1 ? "no checksum" : "corrupted",
+						path ? "head" : "receive");
+					ok = 0;
+				}
+			}
+		}
+	}
+	printf("udp with ip options: %s\n", ok ? "ok" : "FAIL");
+	return ok;
+}
+#endif
+
+// Inject the frame FRAMES times and process it, expecting one answer
+// (answer != NULL) or none per frame.
+static int run(const char *name, uint16_t (*receive)(void), const uint8_t *frame, uint16_t len,
+		const uint8_t *answer, uint16_t answerLen)
+{
+	struct enc28j60_sim_stats before = sim.stats;
+	uint64_t t0, t;
+	uint32_t i, want = answer ? FRAMES : 0;
+
+	expect = answer;
+	expectLen = answerLen;
+	replies = bad = 0;
+	t0 = now_ns();
+	for (i = 0; i < FRAMES; i++) {
+		inject(frame, len);
+		receive();
+	}
+	t = now_ns() - t0;
+	printf("%-28s %5u %8.1f %6.1f %5.1f %8.0f  %s\n", name, len,
+		(double)(sim.stats.spiBytes - before.spiBytes) / FRAMES,
+		(double)(sim.stats.spiTransactions - before.spiTransactions) / FRAMES,
+		(double)(sim.stats.bankSelects - before.bankSelects) / FRAMES,
+		(double)t / FRAMES,
+		replies == want && bad == 0 ? "ok" : "FAIL");
+	return replies == want && bad == 0;
+}
+
+// read frames until the receive buffer is empty
+static void drain(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < 1000 && enc28j60hasRxPkt(); i++)
+		receive_plain();
+}
+
+// Bursts the driver has to recover from: noise frames (needing no answer)
+// until the receive buffer overflows, then 80 % full (with
+// ETHERNET_RX_BACKPRESSURE this turns flow control on), then a frame with a
+// corrupted next packet pointer. Each time the next frame must get through.
+static int recovery(const uint8_t *noise, uint16_t noiseLen)
+{
+	struct enc28j60_stats st;
+	uint32_t i, n, dropped = sim.stats.rxDropped;
+	uint16_t ringSize = enc28j60CurrentDevice()->rxStop + 1;
+	uint8_t eflocon;
+	int ok = 1;
+
+	expect = NULL;
+	replies = bad = 0;
+	enc28j60ClearStats();
+
+	for (i = 0; i < 400; i++)
+		inject(noise, noiseLen);
+	drain();
+	enc28j60GetStats(&st);
+	printf("overflow: dropped by the chip %u, resets %u, discarded %u\n",
+		sim.stats.rxDropped - dropped, st.rxResets, st.rxDiscarded);
+	ok &= st.rxOverflows == 1 && st.rxResets == 1;
+
+	// a frame in the ring takes 6 + 64 bytes
+	n = ringSize * 8 / 10 / 70;
+	for (i = 0; i < n; i++)
+		inject(noise, noiseLen);
+	drain();
+	enc28j60GetStats(&st);
+	// flow control is on above the high water mark and released when drained
+	eflocon = sim.reg[3][EFLOCON & ADDR_MASK] & (EFLOCON_FCEN1|EFLOCON_FCEN0);
+	printf("80%% full: flow control %u, pauses %u, resets %u, EFLOCON %x after\n",
+		sim.stats.flowControl, st.rxPauses, st.rxResets, eflocon);
+	ok &= st.rxResets == 1;
+#if ETHERNET_RX_BACKPRESSURE
+	// released: a pause with time 0 in full duplex, nothing in half duplex
+	ok &= st.rxPauses >= 1 && sim.stats.flowControl >= 1
+		&& eflocon == (enc28j60GetDuplex() ? EFLOCON_FCEN1|EFLOCON_FCEN0 : 0);
+#else
+	ok &= st.rxPauses == 0 && sim.stats.flowControl == 0 && eflocon == 0;
+#endif
+
+	// as if an even ERXRDPT had been programmed (errata 14)
+	sim.rdptCorrupt = 1;
+	inject(noise, noiseLen);
+	sim.rdptCorrupt = 0;
+	drain();
+	enc28j60GetStats(&st);
+	printf("bad next packet pointer: bad vectors %u, resets %u\n",
+		st.rxBadVectors, st.rxResets);
+	ok &= st.rxBadVectors == 1 && st.rxResets == 2;
+
+	return ok && replies == 0;
+}
+
+// registers enc28j60Recover has to program again
+static const uint8_t configRegs[] = {
+	ERXSTL, ERXSTH, ERXNDL, ERXNDH, ERXFCON, EPMM0, EPMM1, EPMCSL, EPMCSH,
+	EHT0, EHT1, EHT2, EHT3, EHT4, EHT5, EHT6, EHT7,
+	MACON1, MACON3, MABBIPG, MAMXFLL, MAMXFLH,
+	MAADR0, MAADR1, MAADR2, MAADR3, MAADR4, MAADR5,
+};
+
+static void config(uint8_t *regs, uint16_t *phlcon)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(configRegs); i++)
+		regs[i] = sim.reg[(configRegs[i] & BANK_MASK) >> 5][configRegs[i] & ADDR_MASK];
+	*phlcon = sim.phy[PHLCON];
+}
+
+// Send a ping, with the answer expected within the receive call or not
+static int ping(const uint8_t *req, uint16_t reqLen, uint32_t want)
+{
+	replies = bad = 0;
+	inject(req, reqLen);
+	receive_plain();
+	return replies == want && bad == 0;
+}
+
+// Hot resets: the chip loses its setup and the SPI transfer noticing it
+// fails, the receive buffer stays corrupt after resetting it, and
+// transmissions stop completing. Each time the chip has to answer pings
+// again with its configuration back and the stack untouched.
+static int hotReset(void)
+{
+	static const uint8_t hash[8] = {0x00, 0x40, 0x00, 0x00, 0x01, 0x00, 0x00, 0x80};
+	static uint8_t req[BUFFER_SIZE], ans[BUFFER_SIZE];
+	uint8_t before[sizeof(configRegs)], after[sizeof(configRegs)];
+	uint16_t reqLen, ansLen, phlconBefore, phlconAfter;
+	struct enc28j60_stats st;
+	uint32_t i;
+	int ok = 1, step;
+
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, 56);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, 56);
+	set_df(ans);
+	expect = ans;
+	expectLen = ansLen;
+	enc28j60SetHashTable(hash);
+	enc28j60PhyWrite(PHLCON, 0x3476);
+	config(before, &phlconBefore);
+	enc28j60ClearStats();
+
+	enc28j60SimPowerCycle(&sim);
+	sim.spiErrors = 1;
+	receive_plain();
+	// the next receive call does the hot reset
+	receive_plain();
+	step = ping(req, reqLen, 1);
+	config(after, &phlconAfter);
+	step &= memcmp(before, after, sizeof(before)) == 0 && phlconBefore == phlconAfter;
+	enc28j60GetStats(&st);
+	printf("hot reset after an spi error: %u us, %s\n", st.recoverUs, step ? "ok" : "FAIL");
+	ok &= step && st.recoverSpi == 1;
+
+	for (i = 0; i < ETHERNET_RECOVER_RX_RESETS; i++) {
+		sim.rdptCorrupt = 1;
+		ping(req, reqLen, 0);
+	}
+	receive_plain();
+	step = ping(req, reqLen, 1);
+	enc28j60GetStats(&st);
+	printf("hot reset after %u receive buffer resets: %u us, %s\n", st.rxResets, st.recoverUs,
+		step ? "ok" : "FAIL");
+	ok &= step && st.recoverRx == 1;
+
+	// the answers are stuck, each times out after ETHERNET_TX_TIMEOUT
+	sim.txHang = 1;
+	for (i = 0; i < ETHERNET_RECOVER_TX_TIMEOUTS; i++) {
+		ping(req, reqLen, 0);
+		enc28j60PortDelayMs(ETHERNET_TX_TIMEOUT + 1);
+		receive_plain();
+	}
+	receive_plain();
+	step = ping(req, reqLen, 1);
+	enc28j60GetStats(&st);
+	printf("hot reset after %u transmit timeouts: %u us, %s\n", st.txTimeouts, st.recoverUs,
+		step ? "ok" : "FAIL");
+	ok &= step && st.recoverTx == 1 && st.recoverFailed == 0;
+
+	// a node that only sends: the send after the spi error does the hot reset
+	enc28j60SimPowerCycle(&sim);
+	sim.spiErrors = 1;
+	enc28j60PacketSend(ansLen, ans);
+	replies = bad = 0;
+	enc28j60PacketSend(ansLen, ans);
+	config(after, &phlconAfter);
+	enc28j60GetStats(&st);
+	step = replies == 1 && bad == 0 && memcmp(before, after, sizeof(before)) == 0
+		&& phlconBefore == phlconAfter && st.recoverSpi == 2;
+	printf("hot reset on the send path: %u us, %s\n", st.recoverUs, step ? "ok" : "FAIL");
+	ok &= step;
+
+	enc28j60SetHashTable((const uint8_t *)"\0\0\0\0\0\0\0\0");
+	return ok;
+}
+
+// The driver against each silicon revision the simulator models: the
+// errata workarounds found from EREVID (an unknown one keeps all of them,
+// the errata-free one is added with enc28j60AddRevision), a burst of pings drained with
+// enc28j60hasRxPkt (PKTIF), a ping after an aborted transmission (TXRST),
+// and the SPI traffic per ping.
+static int revisions(void)
+{
+	static const struct {
+		uint8_t erevid;
+		const char *name;
+		uint8_t errata;
+	} revs[] = {
+		{ ENC28J60_SIM_REV_B1, "B1", ENC28J60_ERRATA_ALL },
+		{ ENC28J60_SIM_REV_B4, "B4", ENC28J60_ERRATA_ALL },
+		{ ENC28J60_SIM_REV_B5, "B5", ENC28J60_ERRATA_ALL },
+		{ ENC28J60_SIM_REV_B7, "B7", ENC28J60_ERRATA_ALL },
+		{ ENC28J60_SIM_REV_B7 + 1, "after B7", 0 },
+		{ ENC28J60_SIM_REV_B7 + 2, "?", ENC28J60_ERRATA_ALL },
+	};
+	static uint8_t req[BUFFER_SIZE], ans[BUFFER_SIZE];
+	const struct enc28j60_rev *rev;
+	struct enc28j60_sim_stats before;
+	uint16_t reqLen, ansLen;
+	uint32_t i, r, burst, abort;
+	int ok = 1, revOk;
+
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, 56);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, 56);
+	set_df(ans);
+	expect = ans;
+	expectLen = ansLen;
+
+	enc28j60AddRevision(ENC28J60_SIM_REV_B7 + 1, "after B7", 0);
+	printf("%-9s %6s %6s %6s %6s %6s %6s %6s\n", "revision", "errata", "burst", "abort",
+		"spi B", "cs", "bank", "even");
+	for (r = 0; r < sizeof(revs) / sizeof(revs[0]); r++) {
+		enc28j60SimInit(&sim);
+		sim.revision = revs[r].erevid;
+		sim.txHook = capture;
+		enc28j60Init(mymac);
+		rev = enc28j60GetRevision();
+
+		// 4 pings in the buffer before the first is read
+		replies = bad = 0;
+		for (i = 0; i < 4; i++)
+			inject(req, reqLen);
+		drain();
+		burst = replies;
+
+		// the answer to the first ping is aborted, the second must go out
+		replies = bad = 0;
+		sim.txAbort = 1;
+		inject(req, reqLen);
+		receive_plain();
+		inject(req, reqLen);
+		receive_plain();
+		abort = replies;
+
+		replies = 0;
+		before = sim.stats;
+		for (i = 0; i < 100; i++) {
+			inject(req, reqLen);
+			receive_plain();
+		}
+
+		revOk = strcmp(rev->name, revs[r].name) == 0 && rev->errata == revs[r].errata
+			&& burst == 4 && abort == 1 && replies == 100 && bad == 0 && sim.stats.txStalls == 0;
+		printf("%-9s %6x %4u/4 %4u/1 %6.1f %6.1f %6.1f %6u  %s\n", rev->name, rev->errata,
+			burst, abort, (double)(sim.stats.spiBytes - before.spiBytes) / 100,
+			(double)(sim.stats.spiTransactions - before.spiTransactions) / 100,
+			(double)(sim.stats.bankSelects - before.bankSelects) / 100,
+			sim.stats.rdptEven, revOk ? "ok" : "FAIL");
+		ok &= revOk;
+	}
+	return ok;
+}
+
+// checksum() against the 16-bit loop in csum(): the same result for every
+// length from 20 to 1500 bytes, every alignment and type, and the time per
+// call of both.
+static int checksums(void)
+{
+	static const uint16_t lens[] = { 20, 64, 128, 256, 576, 1024, 1500 };
+	static uint8_t data[BUFFER_SIZE + 4];
+	volatile uint16_t sink = 0;
+	uint64_t t0, tRef, tNew;
+	uint32_t i, n, wrong = 0;
+	uint16_t len;
+	uint8_t off, type;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+	for (len = 20; len <= 1500; len++)
+		for (off = 0; off < 4; off++)
+			for (type = 0; type < 3; type++)
+				wrong += checksum(data + off, len, type) != csum(data + off, len, type);
+	// a sum with many carries
+	memset(data, 0xff, sizeof(data));
+	for (off = 0; off < 4; off++)
+		wrong += checksum(data + off, 1500, 0) != csum(data + off, 1500, 0);
+	printf("checksum: %u wrong\n", wrong);
+
+	printf("%-8s %8s %8s %6s\n", "len", "ref ns", "ns", "x");
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		t0 = now_ns();
+		for (n = 0; n < FRAMES * 10; n++) {
+			data[0] = n;
+			sink += csum(data, lens[i], 0);
+		}
+		tRef = now_ns() - t0;
+		t0 = now_ns();
+		for (n = 0; n < FRAMES * 10; n++) {
+			data[0] = n;
+			sink += checksum(data, lens[i], 0);
+		}
+		tNew = now_ns() - t0;
+		printf("%-8u %8.1f %8.1f %6.2f\n", lens[i], (double)tRef / (FRAMES * 10),
+			(double)tNew / (FRAMES * 10), (double)tRef / tNew);
+	}
+	(void)sink;
+	return wrong == 0;
+}
+
+// The last frame sent, for txChecksums()
+static uint8_t sent[BUFFER_SIZE];
+static uint16_t sentLen;
+
+static void keep(struct enc28j60_sim *s, const uint8_t *frame, uint16_t len)
+{
+	(void)s;
+	memcpy(sent, frame, len);
+	sentLen = len;
+}
+
+// the udp/tcp checksum of the frame just sent against checksum() over it
+// with the field zeroed
+static int txChecksum(const char *name, uint8_t pos, uint8_t type)
+{
+	uint16_t l4len, got, want;
+	int ok;
+
+	// the frames queued in front of it leave first
+	while (enc28j60TxPending())
+		;
+	l4len = ((sent[IP_TOTLEN_H_P] << 8) | sent[IP_TOTLEN_L_P]) - IP_HEADER_LEN;
+	got = (sent[pos] << 8) | sent[pos + 1];
+
+	sent[pos] = sent[pos + 1] = 0;
+	want = checksum(&sent[IP_SRC_P], 8 + l4len, type);
+	ok = sentLen >= ETH_HEADER_LEN + IP_HEADER_LEN + l4len && got == want;
+	printf("tx checksum %-14s %4u %04x %s\n", name, l4len, got, ok ? "ok" : "FAIL");
+	sentLen = 0;
+	return ok;
+}
+
+// A udp and a tcp frame sent by the stack, above ETHERNET_CSUM_OFFLOAD_MIN
+// and of odd length: the checksum in the frame on the wire is the one of
+// checksum(). With ETHERNET_CSUM_OFFLOAD the DMA engine of the chip made it.
+static int txChecksums(void)
+{
+	static char data[301];
+	uint32_t dma = sim.stats.dmaChecksums;
+	uint16_t i;
+	int ok = 1;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+	while (enc28j60TxPending())
+		;
+	sim.txHook = keep;
+
+	send_udp(buf, data, sizeof(data), 1200, peerip, 5000);
+	ok &= txChecksum("udp", UDP_CHECKSUM_H_P, 1);
+
+	// an ack to a tcp segment of the peer, then the data behind it
+	build_ip(buf, mymac, peermac, peerip, myip, IP_PROTO_TCP_V, TCP_HEADER_LEN_PLAIN);
+	put16(buf + TCP_SRC_PORT_H_P, 40000);
+	put16(buf + TCP_DST_PORT_H_P, 80);
+	put16(buf + TCP_SEQ_H_P, 0x1234);
+	put16(buf + TCP_SEQ_H_P + 2, 0x5678);
+	memset(buf + TCP_SEQACK_H_P, 0, 4);
+	buf[TCP_HEADER_LEN_P] = 0x50;
+	buf[TCP_FLAGS_P] = TCP_FLAGS_ACK_V | TCP_FLAGS_PUSH_V;
+	make_tcp_ack_from_any(buf, 1, 0);
+	ok &= txChecksum("tcp ack", TCP_CHECKSUM_H_P, 2);
+	memcpy(buf + TCP_DATA_P, data, sizeof(data));
+	make_tcp_ack_with_data(buf, sizeof(data));
+	ok &= txChecksum("tcp data", TCP_CHECKSUM_H_P, 2);
+
+	sim.txHook = capture;
+#if ETHERNET_CSUM_OFFLOAD
+	// the short ack is summed in software
+	ok &= sim.stats.dmaChecksums - dma == 2;
+#else
+	ok &= sim.stats.dmaChecksums == dma;
+#endif
+	printf("tx checksums by the chip: %u\n", sim.stats.dmaChecksums - dma);
+	return ok;
+}
+
+// enc28j60linkup returns the cached link state without SPI traffic and
+// sees a link change after at most ETHERNET_LINK_POLL ms (with
+// ETHERNET_INT_RX right after the interrupt).
+static int linkPoll(void)
+{
+	struct enc28j60_sim_stats before;
+	uint32_t i, cs;
+	uint8_t up = 1, down, again;
+	int ok;
+
+	enc28j60PortDelayMs(ETHERNET_LINK_POLL + 1);
+	enc28j60linkup();
+	before = sim.stats;
+	for (i = 0; i < FRAMES; i++)
+		up &= enc28j60linkup();
+	cs = sim.stats.spiTransactions - before.spiTransactions;
+
+	enc28j60SimSetLink(&sim, 0);
+	irq();
+	enc28j60PortDelayMs(ETHERNET_LINK_POLL + 1);
+	down = !enc28j60linkup();
+	enc28j60SimSetLink(&sim, 1);
+	irq();
+	enc28j60PortDelayMs(ETHERNET_LINK_POLL + 1);
+	again = enc28j60linkup();
+
+	ok = up && down && again;
+#if ETHERNET_INT_RX || ETHERNET_LINK_POLL
+	ok &= cs <= 1;
+#endif
+	printf("link: %u cs for %u calls, down %s, up again %s\n", cs, FRAMES,
+		down ? "ok" : "FAIL", again ? "ok" : "FAIL");
+	return ok;
+}
+
+int main(void)
+{
+	static const uint8_t bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	static const uint8_t zero[6] = {0};
+	static const uint8_t otherip[4] = {192, 168, 1, 99};
+	static uint8_t req[BUFFER_SIZE], ans[BUFFER_SIZE];
+	struct enc28j60_sim_stats before;
+	struct enc28j60_stats st;
+	uint16_t reqLen, ansLen;
+	char name[32];
+	int ok = 1;
+
+	enc28j60SimInit(&sim);
+	sim.txHook = capture;
+	enc28j60SetTransport(&enc28j60SpiSim, &sim);
+	before = sim.stats;
+	enc28j60Init(mymac);
+	init_ip_arp_udp_tcp(mymac, myip, 80);
+	enc28j60GetStats(&st);
+	printf("init: %u spi B, %u cs, %u bank selects, %u us\n", sim.stats.spiBytes - before.spiBytes,
+		sim.stats.spiTransactions - before.spiTransactions,
+		sim.stats.bankSelects - before.bankSelects, st.initUs);
+
+	printf("%-28s %5s %8s %6s %5s %8s\n", "frame", "len", "spi B", "cs", "bank", "ns");
+
+	reqLen = build_arp(req, ETH_ARP_OPCODE_REQ_L_V, bcast, peermac, peerip, zero, myip);
+	ansLen = build_arp(ans, ETH_ARP_OPCODE_REPLY_L_V, peermac, mymac, myip, peermac, peerip);
+	ok &= run("arp request", receive_plain, req, reqLen, ans, ansLen);
+	enc28j60GetStats(&st);
+	printf("first frame %u us after the start of enc28j60Init\n", st.firstRxUs);
+	ok &= run("arp request, fastpath", receive_fastpath, req, reqLen, ans, ansLen);
+
+	reqLen = build_arp(req, ETH_ARP_OPCODE_REQ_L_V, bcast, peermac, peerip, zero, otherip);
+	ok &= run("arp for another host", receive_plain, req, reqLen, NULL, 0);
+	ok &= run("arp for another host, fast", receive_fastpath, req, reqLen, NULL, 0);
+
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, 56);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, 56);
+	set_df(ans);
+	ok &= run("ping 56", receive_plain, req, reqLen, ans, ansLen);
+	ok &= run("ping 56, fastpath", receive_fastpath, req, reqLen, ans, ansLen);
+
+	// the smallest ping the fastpath answers in the chip
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, ETHERNET_FASTPATH_MIN - 42);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, ETHERNET_FASTPATH_MIN - 42);
+	set_df(ans);
+	snprintf(name, sizeof(name), "ping %u", ETHERNET_FASTPATH_MIN - 42);
+	ok &= run(name, receive_plain, req, reqLen, ans, ansLen);
+	strcat(name, ", fastpath");
+	ok &= run(name, receive_fastpath, req, reqLen, ans, ansLen);
+
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, 1400);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, 1400);
+	set_df(ans);
+	ok &= run("ping 1400", receive_plain, req, reqLen, ans, ansLen);
+	ok &= run("ping 1400, fastpath", receive_fastpath, req, reqLen, ans, ansLen);
+#if ETHERNET_CSUM_RX_VERIFY
+	// a broken ip header checksum, both paths must drop it
+	req[24] ^= 0xff;
+	ok &= run("ping bad checksum", receive_plain, req, reqLen, NULL, 0);
+	ok &= run("ping bad checksum, fastpath", receive_fastpath, req, reqLen, NULL, 0);
+	enc28j60GetStats(&st);
+	if (st.rxCsumErrors != 2 * FRAMES) {
+		printf("checksum errors %u FAIL\n", st.rxCsumErrors);
+		ok = 0;
+	}
+	ok &= checksumOptions();
+	// the batch receive keeps the good frames around a bad one
+	{
+		static uint8_t b0[BUFFER_SIZE], b1[BUFFER_SIZE], b2[BUFFER_SIZE];
+		uint8_t *packets[3] = { b0, b1, b2 };
+		uint16_t lens[3];
+		uint8_t n;
+
+		inject(req, reqLen);
+		req[24] ^= 0xff;
+		inject(req, reqLen);
+		inject(req, reqLen);
+		n = enc28j60PacketReceiveBatch(3, BUFFER_SIZE, packets, lens);
+		if (n != 2 || lens[0] != reqLen || lens[1] != reqLen || memcmp(b1, req, reqLen) != 0) {
+			printf("batch receive with a bad checksum: %u frames FAIL\n", n);
+			ok = 0;
+		}
+	}
+#endif
+
+	reqLen = build_arp(req, ETH_ARP_OPCODE_REQ_L_V, bcast, peermac, peerip, zero, otherip);
+	if (!recovery(req, reqLen)) {
+		printf("recovery FAIL\n");
+		ok = 0;
+	}
+	reqLen = build_echo(req, ICMP_TYPE_ECHOREQUEST_V, mymac, peermac, peerip, myip, 56);
+	ansLen = build_echo(ans, ICMP_TYPE_ECHOREPLY_V, peermac, mymac, myip, peerip, 56);
+	set_df(ans);
+	ok &= run("ping 56 after recovery", receive_plain, req, reqLen, ans, ansLen);
+	ok &= txChecksums();
+	ok &= linkPoll();
+
+	if (!hotReset())
+		ok = 0;
+
+	printf("rx %u filtered %u dropped %u tx %u dma %u/%u even ERXRDPT %u\n",
+		sim.stats.rxFrames, sim.stats.rxFiltered, sim.stats.rxDropped, sim.stats.txFrames,
+		sim.stats.dmaCopies, sim.stats.dmaChecksums, sim.stats.rdptEven);
+
+	ok &= revisions();
+	ok &= checksums();
+	return ok ? 0 : 1;
+}
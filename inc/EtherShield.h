@@ -33,10 +33,12 @@
 
 void ES_enc28j60SpiInit( SPI_HandleTypeDef *hspi );
 void ES_enc28j60Init( uint8_t* macaddr);
+uint8_t ES_enc28j60InitWithLayout( uint8_t* macaddr, const struct enc28j60_layout *layout );
 void ES_enc28j60clkout(uint8_t clk);
 uint8_t ES_enc28j60linkup(void);
 void ES_enc28j60PhyWrite(uint8_t address, uint16_t data);
 uint16_t ES_enc28j60PacketReceive(uint16_t len, uint8_t* packet);
+uint8_t ES_enc28j60PacketReceiveBatch(uint8_t count, uint16_t len, uint8_t** packets, uint16_t* lens);
 void ES_enc28j60PacketSend(uint16_t len, uint8_t* packet);
 uint8_t ES_enc28j60Revision(void);
 uint8_t ES_enc28j60Read( uint8_t address );
@@ -73,6 +75,7 @@ void ES_fill_ip_hdr_checksum(uint8_t *buf);
 // return 0 to just continue in the packet loop and return the position 
 // of the tcp data if there is tcp data part
 uint16_t ES_packetloop_icmp_tcp(uint8_t *buf,uint16_t plen);
+uint16_t ES_packet_receive_fastpath(uint8_t *buf,uint16_t len);
 // functions to fill the web pages with data:
 //uint16_t ES_fill_tcp_data_p(uint8_t *buf,uint16_t pos, const prog_char *progmem_s);
 uint16_t ES_fill_tcp_data(uint8_t *buf,uint16_t pos, const char *s);
@@ -160,6 +163,11 @@ uint8_t ES_packetloop_icmp_checkreply(uint8_t *buf,uint8_t *ip_monitoredhost);
 void ES_send_wol(uint8_t *buf,uint8_t *wolmac);
 #endif // WOL_client
 
+#ifdef IGMP_client
+uint8_t ES_igmp_join(uint8_t *buf, const uint8_t *group);
+void ES_igmp_leave(uint8_t *buf, const uint8_t *group);
+#endif // IGMP_client
+
 #ifdef FROMDECODE_websrv_help
 uint8_t ES_find_key_val(char *str,char *strbuf, uint16_t maxlen,char *key);
 void ES_urldecode(char *urlbuf);
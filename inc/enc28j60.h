@@ -2,7 +2,9 @@
 #define __ENC28J60_H
 
 #include "stm32includes.h"
-#define Delay HAL_Delay
+#include "enc28j60_port.h"
+#include "error_handler.h"
+#define Delay enc28j60PortDelayMs
 
 /*
 #pragma GCC push_options
@@ -28,25 +30,171 @@ static inline void uDelay(uint32_t useconds) {
 #	error Please define chip-select pin ETHERNET_CS_PIN, for example by gcc option -DETHERNET_CS_PIN=GPIO_PIN_4
 #endif
 
-#ifndef ETHERNET_CS_DELAY
-#	warning ETHERNET_CS_DELAY is not defined. Setting to "2" (mseconds). Adapter may work very slow or not properly. If the latency on "1" is too big, but on "0" the adapter is not working properly, you can try values >= 10: it will use other delay method (for example try value 1000).
-#	define ETHERNET_CS_DELAY 2
+// Chip-select timing: with ETHERNET_CS_DELAY_NS the delay around CS edges
+// is given in nanoseconds and done by enc28j60_timing.h, otherwise the
+// legacy ETHERNET_CS_DELAY (milliseconds, or loop count if >= 10) is used.
+#if defined(ETHERNET_CS_DELAY_NS)
+#	include "enc28j60_timing.h"
+#	define ETHERNET_CS_DELAY_PROC enc28j60DelayTicks(enc28j60CsDelayTicks)
+#	define ETHERNET_CS_HOLD_PROC enc28j60DelayTicks(enc28j60CsHoldTicks)
+#else
+#	ifndef ETHERNET_CS_DELAY
+#		warning ETHERNET_CS_DELAY is not defined. Setting to "2" (mseconds). Adapter may work very slow or not properly. If the latency on "1" is too big, but on "0" the adapter is not working properly, you can try values >= 10: it will use other delay method (for example try value 1000). Better define ETHERNET_CS_DELAY_NS.
+#		define ETHERNET_CS_DELAY 2
+#	endif
+#	if ETHERNET_CS_DELAY >= 10
+#		define ETHERNET_CS_DELAY_PROC {volatile uint32_t i=ETHERNET_CS_DELAY; while(i--);}
+#	else
+#		define ETHERNET_CS_DELAY_PROC Delay(ETHERNET_CS_DELAY)
+#	endif
+#	define ETHERNET_CS_HOLD_PROC
 #endif
 
-#if ETHERNET_CS_DELAY >= 10
-#	define ETHERNET_CS_DELAY_PROC {volatile uint32_t i=ETHERNET_CS_DELAY; while(i--);}
-#else
-#	define ETHERNET_CS_DELAY_PROC Delay(ETHERNET_CS_DELAY)
+// Buffer memory transfers (enc28j60ReadBuffer/enc28j60WriteBuffer) are done
+// by SPI DMA if ETHERNET_SPI_DMA is set. The SPI handle must have its TX and RX
+// DMA streams linked. Shorter transfers than ETHERNET_SPI_DMA_MIN_LEN are
+// done by polling as DMA setup costs more than it saves there.
+#ifndef ETHERNET_SPI_DMA
+#	define ETHERNET_SPI_DMA 0
+#endif
+#ifndef ETHERNET_SPI_DMA_MIN_LEN
+#	define ETHERNET_SPI_DMA_MIN_LEN 32
+#endif
+
+// Control register operations drive the SPI data register directly unless
+// ETHERNET_SPI_LL is 0, then HAL is used for them as well.
+// ETHERNET_SPI_LL_16BIT sends op+data pairs as one 16-bit frame (STM32F1/F4).
+#ifndef ETHERNET_SPI_LL
+#	define ETHERNET_SPI_LL 1
+#endif
+#ifndef ETHERNET_SPI_LL_16BIT
+#	define ETHERNET_SPI_LL_16BIT 0
+#endif
+
+// Number of full-frame slots in the transmit buffer. With more than one
+// slot the next frame is uploaded while the previous one is transmitted.
+// Every slot takes 1536 bytes from the receive buffer.
+#ifndef ETHERNET_TX_SLOTS
+#	define ETHERNET_TX_SLOTS 2
+#endif
+#define ENC28J60_TX_SLOTS_MAX 8
+#if ETHERNET_TX_SLOTS < 1 || ETHERNET_TX_SLOTS > ENC28J60_TX_SLOTS_MAX
+#	error ETHERNET_TX_SLOTS must be between 1 and 8
+#endif
+
+// Count the bytes used in the receive buffer (two more register reads per
+// received packet).
+#ifndef ETHERNET_RX_STATS
+#	define ETHERNET_RX_STATS 0
+#endif
+
+// Backpressure: when more than ETHERNET_RX_HIGH_WATER percent of the
+// receive buffer is used, enc28j60FlowControl holds the link partner off
+// until it is drained below ETHERNET_RX_LOW_WATER percent. Costs the same
+// two register reads per received packet as ETHERNET_RX_STATS.
+#ifndef ETHERNET_RX_BACKPRESSURE
+#	define ETHERNET_RX_BACKPRESSURE 0
+#endif
+#ifndef ETHERNET_RX_HIGH_WATER
+#	define ETHERNET_RX_HIGH_WATER 75
+#endif
+#ifndef ETHERNET_RX_LOW_WATER
+#	define ETHERNET_RX_LOW_WATER 25
+#endif
+
+// Checksums by the DMA engine of the chip: ETHERNET_CSUM_OFFLOAD lets the
+// IP stack send udp/tcp frames of at least ETHERNET_CSUM_OFFLOAD_MIN bytes
+// with the checksum calculated after the upload, ETHERNET_CSUM_RX_VERIFY
+// drops received IPv4 frames with a bad ip/udp/tcp checksum before they
+// are copied out.
+#ifndef ETHERNET_CSUM_OFFLOAD
+#	define ETHERNET_CSUM_OFFLOAD 0
+#endif
+#ifndef ETHERNET_CSUM_OFFLOAD_MIN
+#	define ETHERNET_CSUM_OFFLOAD_MIN 128
+#endif
+#ifndef ETHERNET_CSUM_RX_VERIFY
+#	define ETHERNET_CSUM_RX_VERIFY 0
+#endif
+// packet_receive_fastpath answers echo requests of at least
+// ETHERNET_FASTPATH_MIN bytes (whole frame) in the chip. Setting up the DMA
+// copy takes 8 more chip selects than reading the rest of the frame and
+// sending it back, below that they cost more than the bytes saved.
+#ifndef ETHERNET_FASTPATH_MIN
+#	define ETHERNET_FASTPATH_MIN 128
+#endif
+// The checksums calculated by the CPU add 32-bit words; on a core with the
+// DSP extension (Cortex-M4/M7, __ARM_FEATURE_DSP) ETHERNET_CSUM_DSP adds
+// the bytes in SIMD lanes with UXTAB16 instead.
+#ifndef ETHERNET_CSUM_DSP
+#	if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP && !ENC28J60_HOST
+#		define ETHERNET_CSUM_DSP 1
+#	else
+#		define ETHERNET_CSUM_DSP 0
+#	endif
+#endif
+
+// Retransmissions of a frame lost to a late collision, and the time in ms
+// after which a transmission that never completes is aborted.
+#ifndef ETHERNET_TX_RETRIES
+#	define ETHERNET_TX_RETRIES 3
+#endif
+#ifndef ETHERNET_TX_TIMEOUT
+#	define ETHERNET_TX_TIMEOUT 50
 #endif
 
-#define disableChip  ETHERNET_CS_GPIO->BSRR = ETHERNET_CS_PIN;\
-	ETHERNET_LED_GPIO->BSRR = ETHERNET_LED_PIN << 16;\
-	ETHERNET_CS_DELAY_PROC;
-#define enableChip   ETHERNET_CS_GPIO->BSRR = ETHERNET_CS_PIN<<16;\
-	ETHERNET_LED_GPIO->BSRR = ETHERNET_LED_PIN;\
-	ETHERNET_CS_DELAY_PROC;
-//#define disableChip  {}
-//#define enableChip   {}
+// Duplex mode set up by enc28j60Init. The ENC28J60 has no autonegotiation,
+// the switch port must be forced to the same mode. enc28j60SetDuplex
+// changes it at runtime.
+#ifndef ETHERNET_FULL_DUPLEX
+#	define ETHERNET_FULL_DUPLEX 0
+#endif
+// pause time sent with flow control, in units of 512 bit times
+#ifndef ETHERNET_PAUSE_TIME
+#	define ETHERNET_PAUSE_TIME 0x1000
+#endif
+
+// Fast init: after the soft reset enc28j60Init waits for the chip clock
+// (1 ms on the revisions with the CLKRDY errata, polling CLKRDY on others)
+// instead of a fixed 50 ms, and ES_enc28j60Init skips the 3 s of LED
+// blinking. enc28j60GetStats reports the init time and the time to the
+// first received frame either way.
+#ifndef ETHERNET_FAST_INIT
+#	define ETHERNET_FAST_INIT 0
+#endif
+
+// Hot reset (enc28j60Recover) after an SPI error, after this many receive
+// buffer resets without a good frame in between, or after this many
+// transmit timeouts in a row. A chip that doesn't answer is tried again
+// every ETHERNET_RECOVER_BACKOFF ms.
+#ifndef ETHERNET_RECOVER_RX_RESETS
+#	define ETHERNET_RECOVER_RX_RESETS 3
+#endif
+#ifndef ETHERNET_RECOVER_TX_TIMEOUTS
+#	define ETHERNET_RECOVER_TX_TIMEOUTS 2
+#endif
+#ifndef ETHERNET_RECOVER_BACKOFF
+#	define ETHERNET_RECOVER_BACKOFF 100
+#endif
+
+// Interrupt driven receive: connect the INT pin to an EXTI line (falling
+// edge) and call enc28j60IrqHandler() from its callback. enc28j60PacketReceive
+// then does no SPI traffic until the chip signals a packet.
+#ifndef ETHERNET_INT_RX
+#	define ETHERNET_INT_RX 0
+#endif
+// Without ETHERNET_INT_RX enc28j60linkup checks for a link change at most
+// every ETHERNET_LINK_POLL ms (0: on every call).
+#ifndef ETHERNET_LINK_POLL
+#	define ETHERNET_LINK_POLL 100
+#endif
+
+// events returned by enc28j60PollEvent()
+#define ENC28J60_EVENT_NONE   0
+#define ENC28J60_EVENT_PKT    1  // packets are waiting in the receive buffer
+#define ENC28J60_EVENT_LINK   2  // link state changed
+#define ENC28J60_EVENT_RXERR  3  // receive buffer overflow
+#define ENC28J60_EVENT_TX     4  // a frame left the transmit buffer
 
 
 // ENC28J60 Control Registers
@@ -247,12 +395,30 @@ static inline void uDelay(uint32_t useconds) {
 #define PHSTAT1_PHDPX    0x0800
 #define PHSTAT1_LLSTAT   0x0004
 #define PHSTAT1_JBSTAT   0x0002
+// ENC28J60 PHY PHSTAT2 Register Bit Definitions
+#define PHSTAT2_TXSTAT   0x2000
+#define PHSTAT2_RXSTAT   0x1000
+#define PHSTAT2_COLSTAT  0x0800
+#define PHSTAT2_LSTAT    0x0400
+#define PHSTAT2_DPXSTAT  0x0200
+#define PHSTAT2_PLRITY   0x0010
+// ENC28J60 PHY PHIE Register Bit Definitions
+#define PHIE_PLNKIE      0x0010
+#define PHIE_PGEIE       0x0002
+// ENC28J60 PHY PHIR Register Bit Definitions
+#define PHIR_PLNKIF      0x0010
+#define PHIR_PGIF        0x0004
 // ENC28J60 PHY PHCON2 Register Bit Definitions
 #define PHCON2_FRCLINK   0x4000
 #define PHCON2_TXDIS     0x2000
 #define PHCON2_JABBER    0x0400
 #define PHCON2_HDLDIS    0x0100
 
+// ENC28J60 EFLOCON Register Bit Definitions
+#define EFLOCON_FULDPXS  0x04
+#define EFLOCON_FCEN1    0x02
+#define EFLOCON_FCEN0    0x01
+
 // ENC28J60 Packet Control Byte Bit Definitions
 #define PKTCTRL_PHUGEEN  0x08
 #define PKTCTRL_PPADEN   0x04
@@ -272,15 +438,108 @@ static inline void uDelay(uint32_t useconds) {
 // The RXSTART_INIT should be zero. See Rev. B4 Silicon Errata
 // buffer boundaries applied to internal 8K ram
 // the entire available packet buffer space is allocated
+// (default layout, enc28j60InitWithLayout can change it at runtime)
 //
+#define ENC28J60_BUFFER_SIZE 0x2000
 // start with RX buf at 0/
 #define RXSTART_INIT     0x0
-// RX buffer end
-#define RXSTOP_INIT      (0x1FFF-0x0600-1)
-// start TX buffer at 0x1FFF-0x0600, place for one full ethernet frame (~1500 bytes)
-#define TXSTART_INIT     (0x1FFF-0x0600)
+// one transmit slot: control byte, full ethernet frame and the status vector
+#define TX_SLOT_SIZE     0x0600
+// RX buffer end, odd so that the errata 13 workaround never writes an even
+// ERXRDPT when the read pointer wraps
+#define RXSTOP_INIT      (TXSTART_INIT-1)
+// TX buffer: ETHERNET_TX_SLOTS full ethernet frames (~1500 bytes) at the end
+#define TXSTART_INIT     (ENC28J60_BUFFER_SIZE-TX_SLOT_SIZE*ETHERNET_TX_SLOTS)
 // stop TX buffer at end of mem
 #define TXSTOP_INIT      0x1FFF
+
+// receive status vector bits 16-31 (datasheet table 7-3), see enc28j60RxStatus
+#define ENC28J60_RXSTAT_CRCERR     0x0010
+#define ENC28J60_RXSTAT_LENERR     0x0020
+#define ENC28J60_RXSTAT_OK         0x0080
+#define ENC28J60_RXSTAT_MULTICAST  0x0100
+#define ENC28J60_RXSTAT_BROADCAST  0x0200
+#define ENC28J60_RXSTAT_CONTROL    0x0800
+#define ENC28J60_RXSTAT_VLAN       0x4000
+
+// Result of a transmission, see enc28j60SetTxCallback
+struct enc28j60_tx_status {
+	uint16_t len;          // frame length
+	uint16_t wireLen;      // bytes put on the wire including collided attempts
+	uint8_t collisions;    // collisions during the last attempt
+	uint8_t retries;       // retransmissions after a late collision
+	uint8_t flags;         // ENC28J60_TXSTAT_*
+};
+#define ENC28J60_TXSTAT_DONE      0x01  // sent
+#define ENC28J60_TXSTAT_DEFER     0x02  // deferred, the medium was busy
+#define ENC28J60_TXSTAT_EXDEFER   0x04  // excessive defer, aborted
+#define ENC28J60_TXSTAT_EXCOLL    0x08  // too many collisions, aborted
+#define ENC28J60_TXSTAT_LATECOLL  0x10  // late collision
+#define ENC28J60_TXSTAT_ABORTED   0x20  // TXERIF was set
+#define ENC28J60_TXSTAT_TIMEOUT   0x40  // did not complete within ETHERNET_TX_TIMEOUT
+
+typedef void (*enc28j60_tx_callback)(const struct enc28j60_tx_status *status);
+
+// enc28j60DuplexCheck results
+#define ENC28J60_DUPLEX_OK    0
+#define ENC28J60_DUPLEX_PHY   1  // PHCON1.PDPXMD differs from the configured mode
+#define ENC28J60_DUPLEX_MAC   2  // MACON3.FULDPX differs from PDPXMD
+#define ENC28J60_DUPLEX_LINK  3  // PHSTAT2.DPXSTAT differs, or no link
+
+// enc28j60PhyPoll results
+#define ENC28J60_PHY_IDLE   0
+#define ENC28J60_PHY_BUSY   1
+#define ENC28J60_PHY_DONE   2
+#define ENC28J60_PHY_READ   3  // internal: read running
+#define ENC28J60_PHY_WRITE  4  // internal: write running
+
+// Runtime buffer memory layout, see enc28j60InitWithLayout. The receive
+// ring starts at 0 (errata 5), the transmit slots follow it and the
+// reserved region is left alone at the end of the memory (e.g. for frame
+// templates, its start is returned by enc28j60ReservedStart).
+struct enc28j60_layout {
+	uint16_t rxSize;       // even, at least ENC28J60_RX_MIN
+	uint8_t txSlots;       // 1..ENC28J60_TX_SLOTS_MAX
+	uint16_t txSlotSize;   // control byte + largest frame + 7 byte status vector
+	uint16_t reserved;
+};
+#define ENC28J60_RX_MIN       0x0600
+#define ENC28J60_TX_SLOT_MIN  72
+
+// enc28j60InitWithLayout return codes
+#define ENC28J60_LAYOUT_OK    0
+#define ENC28J60_LAYOUT_RX    1  // receive ring too small or odd size
+#define ENC28J60_LAYOUT_TX    2  // bad slot count or slot size
+#define ENC28J60_LAYOUT_SIZE  3  // does not fit into the 8 KB
+#define ENC28J60_INIT_CLOCK   4  // the chip clock didn't start after the reset
+
+struct enc28j60_stats {
+	uint8_t rxPktHighWater;    // most packets waiting in the receive buffer (EPKTCNT)
+	uint16_t rxBytesHighWater; // most bytes used in the receive buffer (ETHERNET_RX_STATS)
+	uint16_t rxOverflows;      // RXERIF seen, the receive buffer was reset
+	uint16_t rxBadVectors;     // inconsistent receive status vector, buffer reset
+	uint16_t rxResets;         // receive buffer resets
+	uint32_t rxDiscarded;      // frames thrown away by the resets
+	uint16_t rxPauses;         // backpressure turned on (ETHERNET_RX_BACKPRESSURE)
+	uint32_t rxPackets;
+	uint32_t txPackets;
+	uint16_t rxCsumErrors;     // dropped by ETHERNET_CSUM_RX_VERIFY
+	uint16_t txErrors;         // transmit aborted (TXERIF) or timed out
+	uint16_t txTimeouts;
+	uint16_t txRetries;        // retransmissions after a late collision
+	uint32_t txCollisions;
+	uint16_t txDropped;        // frame larger than a transmit slot
+	// hot resets by enc28j60Recover, by the error that asked for them
+	uint16_t recoverSpi;
+	uint16_t recoverRx;
+	uint16_t recoverTx;
+	uint16_t recoverFailed;    // the chip didn't answer
+	uint32_t recoverUs;        // duration of the last one
+	uint32_t recoverMaxUs;
+	// boot time, kept by enc28j60ClearStats
+	uint32_t initUs;           // duration of the last enc28j60Init
+	uint32_t firstRxUs;        // from its start to the first received frame, 0 before
+};
 //
 // max frame length which the controller will accept:
 #define        MAX_FRAMELEN        1500        // (note: maximum ethernet frame length would be 1518)
@@ -292,28 +551,227 @@ void enc28j60_set_spi(SPI_HandleTypeDef *hspi_new);
 unsigned char ENC28J60_SendByte(unsigned char dt);
 uint8_t enc28j60ReadOp(uint8_t op, uint8_t address);
 
+// One control register access of enc28j60RegBatch: op is
+// ENC28J60_READ_CTRL_REG (the value is stored in data),
+// ENC28J60_WRITE_CTRL_REG, ENC28J60_BIT_FIELD_SET or ENC28J60_BIT_FIELD_CLR.
+struct enc28j60_reg {
+	uint8_t op;
+	uint8_t address;
+	uint8_t data;
+};
+
+#define ENC28J60_REG_READ(address)        { ENC28J60_READ_CTRL_REG, (address), 0 }
+#define ENC28J60_REG_WRITE(address, v)    { ENC28J60_WRITE_CTRL_REG, (address), (uint8_t)(v) }
+#define ENC28J60_REG_SET(address, bits)   { ENC28J60_BIT_FIELD_SET, (address), (bits) }
+#define ENC28J60_REG_CLR(address, bits)   { ENC28J60_BIT_FIELD_CLR, (address), (bits) }
+// a 16-bit register pair, low byte first
+#define ENC28J60_REG_WRITE16(address, v) \
+	ENC28J60_REG_WRITE((address), (v) & 0xff), ENC28J60_REG_WRITE((address) + 1, (uint16_t)(v) >> 8)
+
+// Errata workarounds a silicon revision needs
+#define ENC28J60_ERRATA_CLKRDY 0x01  // the soft reset doesn't clear CLKRDY, wait 1 ms
+#define ENC28J60_ERRATA_PKTIF  0x02  // PKTIF is unreliable, poll EPKTCNT
+#define ENC28J60_ERRATA_RDPT   0x04  // an even ERXRDPT corrupts the ring, free one byte less
+#define ENC28J60_ERRATA_TXRST  0x08  // the transmit logic stalls after an abort, TXRST
+#define ENC28J60_ERRATA_ALL    0x0f
+
+// Silicon revision, detected from EREVID by enc28j60Init. The receive and
+// transmit paths that differ between revisions are called through it.
+struct enc28j60_rev {
+	uint8_t erevid;    // EREVID, 0 for the catch-all entry
+	const char *name;  // "B1", "B4", "B5", "B7", "?" or an added one
+	uint8_t errata;    // ENC28J60_ERRATA_*
+	// frames waiting in the receive buffer, 0 if none; the exact number
+	// may only be read when want is more than 1
+	uint8_t (*rxCount)(uint8_t want);
+	// ERXRDPT value that frees the receive buffer up to nextPacketPtr
+	uint16_t (*rxReleasePtr)(void);
+	// after a transmit error (TXERIF)
+	void (*txError)(void);
+};
+
+// called when an asynchronous buffer transfer is finished
+typedef void (*enc28j60_dma_callback)(void);
+
+#define ENC28J60_EVENT_RING_SIZE 16
+
+#include "enc28j60_spi.h"
+
+// State of one ENC28J60. The driver functions work on the selected device
+// (enc28j60SelectDevice), which is enc28j60DefaultDev on the
+// ETHERNET_CS_* and ETHERNET_LED_* pins unless another one is selected.
+// Each chip needs its own SPI bus when DMA or interrupts are used.
+struct enc28j60_dev {
+	const struct enc28j60_spi_ops *spi;  // transport, ENC28J60_SPI_DEFAULT
+	void *spiCtx;                        // backend data, see enc28j60_spi.h
+	SPI_HandleTypeDef *hspi;
+	GPIO_TypeDef *csPort;
+	uint16_t csPin;
+	GPIO_TypeDef *ledPort;  // NULL for no activity LED
+	uint16_t ledPin;
+
+	uint8_t bank;
+	const struct enc28j60_rev *rev;  // NULL until enc28j60Init
+	// configuration enc28j60Recover programs into the chip again
+	uint8_t mac[6];
+	uint8_t hashTable[8];
+	uint8_t patternMask[8];
+	uint16_t patternOffset;
+	uint16_t patternSum;
+	uint16_t phlcon;  // 0 if not set
+	// recovery: 1 << ENC28j60_Error of the requested ones, the receive
+	// buffer resets and transmit timeouts that count towards it
+	volatile uint8_t recoverPending;
+	uint32_t recoverTick;
+	uint8_t rxResetsInRow;
+	uint8_t txTimeoutsInRow;
+	uint16_t nextPacketPtr;
+	volatile uint8_t rxOverflow;  // RXERIF seen by the interrupt handler
+	uint32_t initStart;           // enc28j60PortMicros at the start of init
+	uint8_t rxPaused;             // backpressure is on
+	uint8_t erxfcon;
+	uint8_t fullDuplex;
+	uint8_t phyOp;
+	// link state, re-read from the PHY only after LINKIF
+	volatile uint8_t linkUp;
+	volatile uint8_t linkValid;
+	// last LINKIF check without ETHERNET_INT_RX
+	uint32_t linkTick;
+
+	// current buffer memory layout
+	uint16_t rxStop;
+	uint16_t txStart;
+	uint16_t txSlotSize;
+	uint8_t txSlots;
+	uint16_t reservedStart;
+
+	struct enc28j60_stats stats;
+
+	// the received frame being processed: address, length and status
+	uint16_t rxFrame;
+	uint16_t rxFrameLen;
+	uint16_t rxFrameStat;
+	// offset in it ERDPT points at, ENC28J60_RX_SEEK after ERDPT moved elsewhere
+	volatile uint16_t rxFrameRead;
+
+	// Transmit ring: the slots after the receive buffer are filled at txHead
+	// and sent in order from txTail. One slot is on the wire at a time.
+	uint16_t txLen[ENC28J60_TX_SLOTS_MAX];
+	uint8_t txHead;
+	uint8_t txTail;
+	volatile uint8_t txCount;
+	volatile uint8_t txActive;
+	uint32_t txStartTick;
+	uint8_t txRetries;
+	struct enc28j60_tx_status txLast;
+	enc28j60_tx_callback txCallback;
+
+#if ETHERNET_INT_RX
+	volatile uint8_t eventRing[ENC28J60_EVENT_RING_SIZE];
+	volatile uint8_t eventHead;
+	volatile uint8_t eventTail;
+	volatile uint8_t busLock;
+	volatile uint8_t irqDeferred;
+	// set when EPKTCNT may be non-zero, receive does no SPI while it is clear
+	volatile uint8_t rxPending;
+	volatile uint16_t eventsDropped;
+#endif
+#if ETHERNET_SPI_DMA
+	// state of the buffer memory transfer currently running on the DMA
+	volatile uint8_t dmaBusy;
+	enc28j60_dma_callback dmaCallback;
+#endif
+	struct enc28j60_dev *next;  // devices known to enc28j60DmaComplete
+};
+
+extern struct enc28j60_dev enc28j60DefaultDev;
+
+void enc28j60DevInit(struct enc28j60_dev *d, SPI_HandleTypeDef *hspi, GPIO_TypeDef *csPort, uint16_t csPin, GPIO_TypeDef *ledPort, uint16_t ledPin);
+void enc28j60SelectDevice(struct enc28j60_dev *d);
+struct enc28j60_dev *enc28j60CurrentDevice(void);
+// use another SPI transport for the selected device, ctx is passed to the
+// backend in dev->spiCtx
+void enc28j60SetTransport(const struct enc28j60_spi_ops *ops, void *ctx);
+
 
 // functions
 extern uint8_t enc28j60ReadOp(uint8_t op, uint8_t address);
 extern void enc28j60WriteOp(uint8_t op, uint8_t address, uint8_t data);
 extern void enc28j60ReadBuffer(uint16_t len, uint8_t* data);
 extern void enc28j60WriteBuffer(uint16_t len, uint8_t* data);
+extern void enc28j60ReadBufferAsync(uint16_t len, uint8_t* data, enc28j60_dma_callback callback);
+extern void enc28j60WriteBufferAsync(uint16_t len, uint8_t* data, enc28j60_dma_callback callback);
+extern uint8_t enc28j60DmaBusy(void);
+// call from HAL_SPI_TxCpltCallback and HAL_SPI_TxRxCpltCallback when using
+// ETHERNET_SPI_DMA, otherwise completion is only noticed by polling
+extern void enc28j60DmaComplete(SPI_HandleTypeDef *hspi_done);
 extern void enc28j60SetBank(uint8_t address);
+extern void enc28j60RegBatch(struct enc28j60_reg *regs, uint8_t count);
 extern uint8_t enc28j60Read(uint8_t address);
 extern void enc28j60Write(uint8_t address, uint8_t data);
 extern void enc28j60PhyWrite(uint8_t address, uint16_t data);
+extern uint16_t enc28j60PhyRead(uint8_t address);
+extern uint16_t enc28j60PhyReadH(uint8_t address);
+extern uint8_t enc28j60PhyStartRead(uint8_t address);
+extern uint8_t enc28j60PhyStartWrite(uint8_t address, uint16_t data);
+extern uint8_t enc28j60PhyPoll(uint16_t *data);
 extern void enc28j60clkout(uint8_t clk);
 extern void enc28j60SpiInit(void);
 extern void enc28j60Init(uint8_t* macaddr);
+extern uint8_t enc28j60InitWithLayout(uint8_t* macaddr, const struct enc28j60_layout *layout);
+extern uint16_t enc28j60ReservedStart(void);
+extern void enc28j60GetStats(struct enc28j60_stats *out);
+extern void enc28j60ClearStats(void);
+// Ask for a hot reset of the selected chip, the next receive or send call
+// (or enc28j60TxPoll) does it. Frames to send are dropped while the chip
+// doesn't answer. Called by the default ENC28j60_Error_Handler.
+extern void enc28j60RequestRecovery(enum ENC28j60_Error error);
+// Soft reset the chip and program it again from the configuration of the
+// last enc28j60Init and the filters set since, in a few ms. The stack
+// (addresses, ARP and DHCP state) is not touched, queued transmissions are
+// lost. Returns 0 if the chip didn't answer.
+extern uint8_t enc28j60Recover(void);
 extern void enc28j60PacketSend(uint16_t len, uint8_t* packet);
+extern void enc28j60PacketSendCsum(uint16_t len, uint8_t* packet, uint16_t csumStart, uint16_t csumLen, uint16_t csumPos);
+extern uint16_t enc28j60DmaChecksum(uint16_t start, uint16_t len);
+extern void enc28j60TxPoll(void);
+extern uint8_t enc28j60TxPending(void);
+extern void enc28j60TxLastStatus(struct enc28j60_tx_status *st);
+extern void enc28j60SetTxCallback(enc28j60_tx_callback callback);
 extern uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet);
+extern uint8_t enc28j60PacketReceiveBatch(uint8_t count, uint16_t maxlen, uint8_t** packets, uint16_t* lens);
+extern uint16_t enc28j60RxHead(uint16_t headlen, uint8_t* head);
+extern uint16_t enc28j60RxRest(uint16_t headlen, uint16_t maxlen, uint8_t* packet);
+extern uint16_t enc28j60RxStatus(void);
+extern void enc28j60RxRead(uint16_t offset, uint16_t len, uint8_t* data);
+extern void enc28j60RxFinish(void);
+extern void enc28j60PacketSendFromRx(uint16_t hdrlen, uint8_t* hdr, uint16_t offset, uint16_t len);
 extern uint8_t enc28j60getrev(void);
+// Silicon revision found by enc28j60Init, an unknown EREVID gets the
+// workarounds of B1 ("?")
+extern const struct enc28j60_rev *enc28j60GetRevision(void);
+// Add an entry for EREVID erevid with only the errata given, which selects
+// the cheaper paths for the others. For silicon known to be fixed and the
+// simulator; call before enc28j60Init, a later call replaces the entry.
+extern void enc28j60AddRevision(uint8_t erevid, const char *name, uint8_t errata);
 extern uint8_t enc28j60hasRxPkt(void);
+extern void enc28j60IrqHandler(void);
+extern void enc28j60DevIrqHandler(struct enc28j60_dev *d);
+extern uint8_t enc28j60PollEvent(void);
 extern uint8_t enc28j60linkup(void);
+extern void enc28j60SetDuplex(uint8_t full);
+extern uint8_t enc28j60GetDuplex(void);
+extern uint8_t enc28j60DuplexCheck(void);
+extern void enc28j60FlowControl(uint8_t on);
 extern void enc28j60EnableBroadcast( void );
 extern void enc28j60DisableBroadcast( void );
 extern void enc28j60EnableMulticast( void );
 extern void enc28j60DisableMulticast( void );
+extern void enc28j60SetRxFilter(uint8_t flags);
+extern uint8_t enc28j60GetRxFilter(void);
+extern uint8_t enc28j60HashIndex(const uint8_t *mac);
+extern void enc28j60SetHashTable(const uint8_t *table);
+extern void enc28j60SetPattern(uint16_t offset, const uint8_t *mask, uint16_t sum);
 extern void enc28j60PowerDown();
 extern void enc28j60PowerUp();
 
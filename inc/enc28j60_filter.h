@@ -0,0 +1,71 @@
+#ifndef __ENC28J60_FILTER_H
+#define __ENC28J60_FILTER_H
+
+#include "stm32includes.h"
+
+// Pattern match receive filter of the ENC28J60 (datasheet 8.2).
+//
+// The chip takes up to 64 consecutive frame bytes starting at EPMO,
+// selects some of them with the EPMM0..7 mask and compares the IP
+// checksum of the selected bytes with EPMCS. A filter is built up from
+// byte comparisons and compiled into those registers by
+// enc28j60FilterApply(), e.g. "IPv4 UDP to port 5000 from 10.0.0.0/24":
+//
+//	struct enc28j60_filter f;
+//	static const uint8_t net[] = {10, 0, 0, 0};
+//	enc28j60FilterInit(&f);
+//	enc28j60FilterIpProto(&f, IP_PROTO_UDP_V);
+//	enc28j60FilterIpSrc(&f, net, 24);
+//	enc28j60FilterUdpDstPort(&f, 5000);
+//	enc28j60FilterApply(&f);
+//	enc28j60SetRxFilter(ENC28J60_RXFILTER_PATTERN_ONLY);
+//
+// The hardware compares whole bytes through a checksum, so prefixes are
+// rounded down to whole bytes (a /20 matches the /16) and a frame with
+// different bytes of the same checksum gets through. The stack must
+// still check what it receives, the filter only takes load off the MCU.
+
+#define ENC28J60_FILTER_WINDOW  64
+
+struct enc28j60_filter {
+	uint8_t count;
+	uint16_t pos[ENC28J60_FILTER_WINDOW];   // ascending frame offsets
+	uint8_t value[ENC28J60_FILTER_WINDOW];
+};
+
+#define ENC28J60_FILTER_OK      0
+#define ENC28J60_FILTER_EMPTY   1  // nothing to compare
+#define ENC28J60_FILTER_SPAN    2  // compared bytes don't fit into 64
+
+// ERXFCON profiles for enc28j60SetRxFilter()
+// power-on setting: own unicast, broadcast ARP (the default pattern)
+#define ENC28J60_RXFILTER_DEFAULT \
+	(ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN|ERXFCON_BCEN)
+// only frames matching the pattern; broadcast ARP requests are dropped
+#define ENC28J60_RXFILTER_PATTERN_ONLY \
+	(ERXFCON_CRCEN|ERXFCON_PMEN)
+// own unicast frames that also match the pattern (no ARP requests either)
+#define ENC28J60_RXFILTER_UNICAST_AND_PATTERN \
+	(ERXFCON_ANDOR|ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN)
+// everything with a good CRC
+#define ENC28J60_RXFILTER_PROMISC \
+	(ERXFCON_CRCEN)
+
+void enc28j60FilterInit(struct enc28j60_filter *f);
+// compare len bytes at frame offset pos, returns 0 if they don't fit
+uint8_t enc28j60FilterMatch(struct enc28j60_filter *f, uint16_t pos, const uint8_t *bytes, uint8_t len);
+uint8_t enc28j60FilterEtherType(struct enc28j60_filter *f, uint16_t type);
+// IPv4 with the given protocol
+uint8_t enc28j60FilterIpProto(struct enc28j60_filter *f, uint8_t proto);
+uint8_t enc28j60FilterIpSrc(struct enc28j60_filter *f, const uint8_t *ip, uint8_t prefix);
+uint8_t enc28j60FilterIpDst(struct enc28j60_filter *f, const uint8_t *ip, uint8_t prefix);
+// ports assume an IP header without options
+uint8_t enc28j60FilterUdpSrcPort(struct enc28j60_filter *f, uint16_t port);
+uint8_t enc28j60FilterUdpDstPort(struct enc28j60_filter *f, uint16_t port);
+uint8_t enc28j60FilterTcpDstPort(struct enc28j60_filter *f, uint16_t port);
+
+// Compile the filter into EPMO, EPMM0..7 and EPMCS.
+// Returns an ENC28J60_FILTER_* code, the chip is not touched on error.
+uint8_t enc28j60FilterApply(const struct enc28j60_filter *f);
+
+#endif /* __ENC28J60_FILTER_H */
@@ -0,0 +1,39 @@
+#ifndef __ENC28J60_HOST_H
+#define __ENC28J60_HOST_H
+
+// The few STM32 HAL and CMSIS definitions the library needs, for building
+// it on a Linux host (ENC28J60_HOST). The SPI handle and GPIO ports are
+// only passed around there, the transport (enc28j60_spi.h) does the I/O
+// and the clock comes from the port (enc28j60_port.h).
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct GPIO_TypeDef GPIO_TypeDef;
+typedef struct __SPI_HandleTypeDef SPI_HandleTypeDef;
+
+// there are no interrupts to mask on the host
+static inline uint32_t __get_PRIMASK(void)
+{
+	return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	(void)primask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+static inline void __enable_irq(void)
+{
+}
+
+static inline void __DMB(void)
+{
+	__sync_synchronize();
+}
+
+#endif /* __ENC28J60_HOST_H */
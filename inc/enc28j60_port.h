@@ -0,0 +1,72 @@
+#ifndef __ENC28J60_PORT_H
+#define __ENC28J60_PORT_H
+
+#include "stm32includes.h"
+
+// Platform services of the driver and the stack: a monotonic clock, a
+// delay and a yield for waits, and the chip-select/LED pins. ETHERNET_PORT
+// selects the implementation at build time:
+//
+//	ENC28J60_PORT_STM32     STM32 HAL, HAL tick and SysTick, busy waits
+//	ENC28J60_PORT_FREERTOS  STM32 HAL pins, FreeRTOS tick, vTaskDelay and
+//	                        taskYIELD so other tasks run while the chip is
+//	                        waited for
+//	ENC28J60_PORT_POSIX     Linux host (ENC28J60_HOST), CLOCK_MONOTONIC,
+//	                        nanosleep and sched_yield; the spidev driver
+//	                        handles CS, so the pin operations do nothing
+
+#define ENC28J60_PORT_STM32 0
+#define ENC28J60_PORT_FREERTOS 1
+#define ENC28J60_PORT_POSIX 2
+
+#ifndef ETHERNET_PORT
+#	if ENC28J60_HOST
+#		define ETHERNET_PORT ENC28J60_PORT_POSIX
+#	else
+#		define ETHERNET_PORT ENC28J60_PORT_STM32
+#	endif
+#endif
+
+#if ETHERNET_PORT == ENC28J60_PORT_POSIX && !ENC28J60_HOST
+#	error ENC28J60_PORT_POSIX needs the host build (ENC28J60_HOST)
+#endif
+#if ETHERNET_PORT != ENC28J60_PORT_POSIX && ENC28J60_HOST
+#	error the host build (ENC28J60_HOST) needs ENC28J60_PORT_POSIX
+#endif
+
+// Microseconds and milliseconds since start, both wrap around. Compare
+// with differences: now - start > timeout.
+uint32_t enc28j60PortMicros(void);
+uint32_t enc28j60PortMillis(void);
+void enc28j60PortDelayMs(uint32_t ms);
+// Called in every loop waiting for the chip (PHY, DMA, a free transmit
+// slot, DHCP and DNS answers): gives the CPU to other tasks if there are
+// any.
+void enc28j60PortYield(void);
+
+// drive a chip-select or LED pin
+#if ETHERNET_PORT == ENC28J60_PORT_POSIX
+static inline void enc28j60PortPinHigh(GPIO_TypeDef *port, uint16_t pin)
+{
+	(void)port;
+	(void)pin;
+}
+
+static inline void enc28j60PortPinLow(GPIO_TypeDef *port, uint16_t pin)
+{
+	(void)port;
+	(void)pin;
+}
+#else
+static inline void enc28j60PortPinHigh(GPIO_TypeDef *port, uint16_t pin)
+{
+	port->BSRR = pin;
+}
+
+static inline void enc28j60PortPinLow(GPIO_TypeDef *port, uint16_t pin)
+{
+	port->BSRR = (uint32_t)pin << 16;
+}
+#endif
+
+#endif /* __ENC28J60_PORT_H */
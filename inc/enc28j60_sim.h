@@ -0,0 +1,110 @@
+#ifndef __ENC28J60_SIM_H
+#define __ENC28J60_SIM_H
+
+#include "enc28j60.h"
+
+// Behavioural model of the ENC28J60 behind the SPI transport, to run the
+// driver and the stack without hardware:
+//
+//	static struct enc28j60_sim sim;
+//	enc28j60SimInit(&sim);
+//	sim.txHook = capture;
+//	enc28j60SetTransport(&enc28j60SpiSim, &sim);
+//	enc28j60Init(mac);
+//	enc28j60SimInject(&sim, frame, len);
+//	plen = enc28j60PacketReceive(sizeof(buf), buf);
+//
+// Modelled are the SPI commands with the MAC/MII dummy byte, the control
+// registers and banks, the 8 KB buffer memory with the pointer
+// auto-increment and the receive ring wrap, the receive filters, the
+// receive status vector, EPKTCNT/PKTDEC, transmission with TXRTS/TXIF and
+// the status vector, the DMA copy and checksum, and the MII with the PHY
+// registers. Everything completes at once, there is no timing.
+//
+// The chip answers with the EREVID in sim.revision (B7 unless changed after
+// enc28j60SimInit, it takes effect with the soft reset of enc28j60Init).
+// The released revisions B1 to B7 have the errata the driver works around:
+//
+//	- the soft reset leaves CLKRDY set (errata 2)
+//	- PKTIF is set by an arriving frame and cleared by every PKTDEC, even
+//	  when frames are left (errata 6)
+//	- after a transmit abort (TXERIF) no frame is sent until TXRST has
+//	  been set (errata 12)
+//	- programming an even value other than ERXST into ERXRDPT corrupts the
+//	  next packet pointer of the next received frame (errata 14)
+//
+// A revision after B7 has none of them (the driver only uses the cheaper
+// paths once it is added with enc28j60AddRevision): the soft reset clears
+// CLKRDY for the next ENC28J60_SIM_CLKRDY_READS reads of ESTAT, and PKTIF
+// follows EPKTCNT. Even ERXRDPT values are counted in stats.rdptEven on all of them.
+// Setting txAbort aborts the next transmission, txHang keeps every
+// transmission from completing until the next soft reset, and spiErrors
+// makes that many transfers fail with ENC28j60_Error_Handler(SPI_ERROR).
+
+#define ENC28J60_SIM_MEM_SIZE 0x2000
+#define ENC28J60_SIM_REV_B1 2
+#define ENC28J60_SIM_REV_B4 4
+#define ENC28J60_SIM_REV_B5 5
+#define ENC28J60_SIM_REV_B7 6
+#define ENC28J60_SIM_REV_DEFAULT ENC28J60_SIM_REV_B7
+#define ENC28J60_SIM_CLKRDY_READS 3
+
+struct enc28j60_sim_stats {
+	uint32_t spiBytes;         // bytes clocked over SPI
+	uint32_t spiTransactions;  // chip selects
+	uint32_t rxFrames;         // written to the receive buffer
+	uint32_t rxFiltered;       // rejected by the receive filters
+	uint32_t rxDropped;        // receive disabled, ring full or EPKTCNT at 255
+	uint32_t txFrames;
+	uint32_t dmaCopies;
+	uint32_t dmaChecksums;
+	uint32_t phyOps;
+	uint32_t rdptEven;         // even ERXRDPT programmed, see above
+	uint32_t txStalls;         // TXRTS ignored after an abort, see above
+	uint32_t flowControl;      // EFLOCON turned on (PAUSE or jamming)
+	uint32_t bankSelects;      // ECON1 writes for the bank select bits
+};
+
+struct enc28j60_sim {
+	uint8_t mem[ENC28J60_SIM_MEM_SIZE];
+	// banked registers, the common ones (0x1B..0x1F) are kept in bank 0
+	uint8_t reg[4][32];
+	uint16_t phy[32];
+	uint8_t revision;
+	uint8_t linkUp;
+	uint8_t rdptCorrupt;  // ERXRDPT was programmed even
+	uint8_t txAbort;      // abort the next transmission, see above
+	uint8_t txHang;       // no transmission completes, see above
+	uint8_t spiErrors;    // transfers to fail, see above
+	uint8_t pktif;        // PKTIF with the errata
+	uint8_t txStalled;    // transmit logic stalled by an abort
+	uint8_t clkWait;      // ESTAT reads until CLKRDY after a reset
+
+	// SPI command in progress
+	uint8_t cmd;
+	uint8_t arg;
+	uint8_t count;
+
+	// called for every transmitted frame, without CRC
+	void (*txHook)(struct enc28j60_sim *sim, const uint8_t *frame, uint16_t len);
+	void *user;
+
+	struct enc28j60_sim_stats stats;
+};
+
+extern const struct enc28j60_spi_ops enc28j60SpiSim;
+
+// power-on state, link up
+void enc28j60SimInit(struct enc28j60_sim *sim);
+// A frame arriving from the wire (without CRC, padded to 60 bytes like a
+// sender does). Returns 1 if it was written to the receive buffer.
+uint8_t enc28j60SimInject(struct enc28j60_sim *sim, const uint8_t *frame, uint16_t len);
+// the chip lost power for a moment: registers and PHY back to their
+// power-on state, the buffer memory keeps its content
+void enc28j60SimPowerCycle(struct enc28j60_sim *sim);
+// change the link state, sets the PHY interrupt flags
+void enc28j60SimSetLink(struct enc28j60_sim *sim, uint8_t up);
+// level of the INT pin (1 = asserted)
+uint8_t enc28j60SimIntPending(struct enc28j60_sim *sim);
+
+#endif /* __ENC28J60_SIM_H */
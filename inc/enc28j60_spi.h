@@ -0,0 +1,63 @@
+#ifndef __ENC28J60_SPI_H
+#define __ENC28J60_SPI_H
+
+#include "stm32includes.h"
+
+// SPI transport of the ENC28J60 driver. Every access to the chip goes
+// through the operations of the selected device (dev->spi), so a board
+// picks the fastest backend and the driver runs unchanged on a host.
+//
+// select/release frame one SPI transaction (CS low/high). transfer is
+// full duplex for the command bytes, rx may be NULL when nothing useful
+// comes back. read/write move buffer memory data, the chip ignores MOSI
+// while reading. The async variants start a buffer memory transfer and
+// return at once, asyncBusy tells when it is done; they are NULL if the
+// backend can't do that. Errors go to ENC28j60_Error_Handler(SPI_ERROR).
+
+struct enc28j60_dev;
+
+struct enc28j60_spi_ops {
+	void (*init)(struct enc28j60_dev *d);
+	void (*select)(struct enc28j60_dev *d);
+	void (*release)(struct enc28j60_dev *d);
+	void (*transfer)(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len);
+	void (*read)(struct enc28j60_dev *d, uint8_t *data, uint16_t len);
+	void (*write)(struct enc28j60_dev *d, const uint8_t *data, uint16_t len);
+	// return 0 when the transfer was started
+	uint8_t (*readAsync)(struct enc28j60_dev *d, uint8_t *data, uint16_t len);
+	uint8_t (*writeAsync)(struct enc28j60_dev *d, const uint8_t *data, uint16_t len);
+	uint8_t (*asyncBusy)(struct enc28j60_dev *d);
+};
+
+#if ENC28J60_HOST
+// Linux spidev, spiCtx points to a struct enc28j60_spidev (NULL for
+// ETHERNET_SPIDEV). CS is driven by the spidev driver.
+#ifndef ETHERNET_SPIDEV
+#	define ETHERNET_SPIDEV "/dev/spidev0.0"
+#endif
+#ifndef ETHERNET_SPIDEV_HZ
+#	define ETHERNET_SPIDEV_HZ 8000000
+#endif
+
+struct enc28j60_spidev {
+	const char *path;
+	uint32_t speed;  // SPI clock in Hz, the ENC28J60 takes up to 20 MHz
+	int fd;          // opened by init
+};
+
+extern const struct enc28j60_spi_ops enc28j60SpiLinux;
+#	define ENC28J60_SPI_DEFAULT (&enc28j60SpiLinux)
+#else
+// STM32 HAL for everything, CS on dev->csPort/csPin
+extern const struct enc28j60_spi_ops enc28j60SpiHal;
+// control operations at register level polling TXE/RXNE, buffer memory
+// and DMA transfers through HAL
+extern const struct enc28j60_spi_ops enc28j60SpiLL;
+#	if ETHERNET_SPI_LL
+#		define ENC28J60_SPI_DEFAULT (&enc28j60SpiLL)
+#	else
+#		define ENC28J60_SPI_DEFAULT (&enc28j60SpiHal)
+#	endif
+#endif
+
+#endif /* __ENC28J60_SPI_H */
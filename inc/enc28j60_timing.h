@@ -0,0 +1,61 @@
+#ifndef __ENC28J60_TIMING_H
+#define __ENC28J60_TIMING_H
+
+#include "stm32includes.h"
+
+// Nanosecond-scale delays for the SPI chip-select timing of the ENC28J60
+// (datasheet table 16-6: CS setup 50 ns, CS disable 50 ns, CS hold 210 ns
+// after reading a MAC or MII register).
+//
+// Cores with a DWT cycle counter (Cortex-M3/M4/M7) count CPU cycles,
+// others (Cortex-M0) use a busy loop calibrated against the microsecond
+// clock of the port (enc28j60_port.h).
+// Until enc28j60TimingInit() is done the delays are derived from
+// ETHERNET_MCU_CLOCK_HZ, rounded up.
+
+#ifndef ETHERNET_MCU_CLOCK_HZ
+#	define ETHERNET_MCU_CLOCK_HZ 16000000
+#endif
+#ifndef ETHERNET_CS_DELAY_NS
+#	define ETHERNET_CS_DELAY_NS 50
+#endif
+#ifndef ETHERNET_CS_HOLD_NS
+#	define ETHERNET_CS_HOLD_NS 210
+#endif
+
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+#	define ENC28J60_TIMING_DWT 1
+#else
+#	define ENC28J60_TIMING_DWT 0
+#endif
+
+// delay ticks are CPU cycles with DWT, loop iterations otherwise
+extern uint32_t enc28j60CsDelayTicks;
+extern uint32_t enc28j60CsHoldTicks;
+// calibrated delay ticks per microsecond
+extern uint32_t enc28j60TicksPerUs;
+
+static inline void enc28j60DelayTicks(uint32_t ticks)
+{
+#if ENC28J60_TIMING_DWT
+	uint32_t start = DWT->CYCCNT;
+	while ((DWT->CYCCNT - start) < ticks);
+#else
+	volatile uint32_t i = ticks;
+	while (i--);
+#endif
+}
+
+// convert nanoseconds to delay ticks with the current calibration, rounded up
+uint32_t enc28j60NsToTicks(uint32_t ns);
+void enc28j60DelayNs(uint32_t ns);
+
+// Start the cycle counter and measure the real clock against the port
+// clock. Takes about 1 ms, done once (enc28j60_set_spi calls it).
+void enc28j60TimingInit(void);
+
+// Perform count control register reads and return the achieved rate in
+// operations per second (0 if the interval was too short to measure).
+uint32_t enc28j60BenchmarkRegOps(uint32_t count);
+
+#endif /* __ENC28J60_TIMING_H */
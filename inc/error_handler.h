@@ -2,9 +2,12 @@
 #define __ERROR_HANDLER_H
 
 enum ENC28j60_Error {
-    SPI_ERROR
+    SPI_ERROR,      // an SPI transfer failed
+    RX_ERROR,       // the receive buffer stays corrupt after resetting it
+    TX_HANG_ERROR   // transmissions time out one after the other
 };
 
-void __attribute__((weak)) ENC28j60_Error_Handler(enum ENC28j60_Error error);
+// weak default in error_handler.c, see there
+void ENC28j60_Error_Handler(enum ENC28j60_Error error);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,46 @@
+/*********************************************
+ * vim:sw=8:ts=8:si:et
+ * To use the above modeline in vim you must have "set modeline" in your .vimrc
+ * Copyright: GPL V2
+ *
+ * IGMPv2 group membership (rfc 2236) with the multicast hash filter
+ * of the ENC28J60
+ *********************************************/
+//@{
+#ifndef IGMP_H
+#define IGMP_H
+
+#include "stm32includes.h"
+
+#if defined (IGMP_client)
+
+// number of groups that can be joined at the same time
+#ifndef IGMP_MAX_GROUPS
+#	define IGMP_MAX_GROUPS 4
+#endif
+// the unsolicited report after a join is repeated within this time (ms)
+#ifndef IGMP_UNSOLICITED_INTERVAL
+#	define IGMP_UNSOLICITED_INTERVAL 10000
+#endif
+
+// Join a group (224.0.0.0/4): the hash filter of the chip is opened for
+// its mac address and a membership report is sent. buf is used to build
+// the report. Returns 0 if group is no multicast address or the table
+// is full.
+uint8_t igmp_join(uint8_t *buf, const uint8_t *group);
+// leave a group, the hash filter is closed again if no other group uses it
+void igmp_leave(uint8_t *buf, const uint8_t *group);
+uint8_t igmp_is_member(const uint8_t *group);
+
+// Handle a received igmp message: queries schedule reports, reports of
+// other members suppress our own. Returns 0 if buf is no igmp message.
+uint8_t igmp_packet(uint8_t *buf, uint16_t plen);
+// ipv4 frame the stack should keep: igmp or sent to a joined group
+uint8_t igmp_wanted(uint8_t *buf, uint16_t plen);
+// Send the reports that are due. Call it when buf is free, like
+// client_arp_whohas (packetloop_icmp_tcp does with plen 0).
+void igmp_poll(uint8_t *buf);
+
+#endif /* IGMP_client */
+#endif /* IGMP_H */
+//@}
@@ -20,6 +20,29 @@
 
 void __attribute__((weak)) ES_PingCallback(void);
 
+struct enc28j60_dev;
+
+// One network interface: the addresses of this node on it and the
+// ENC28J60 it uses. All functions work on the selected interface, select
+// an interface before handling its packets (ip_if_select also selects its
+// device). The tcp/www/ntp clients keep one session for all interfaces.
+struct ip_interface {
+        struct enc28j60_dev *dev;
+        uint8_t macaddr[6];
+        uint8_t ipaddr[4];
+        uint8_t wwwport_l; // server port
+        uint8_t wwwport_h; // Note: never use same as TCPCLIENT_SRC_PORT_H
+        uint8_t gwip[4];
+        uint8_t gwmacaddr[6];
+        volatile uint8_t waitgwmac;
+        int16_t delaycnt;
+};
+
+// set up an interface on dev, then select it and call init_ip_arp_udp_tcp
+void ip_if_init(struct ip_interface *ifc, struct enc28j60_dev *dev);
+void ip_if_select(struct ip_interface *ifc);
+struct ip_interface *ip_if_current(void);
+
 // -- web server functions --
 // you must call this function once before you use any of the other server functions:
 void init_ip_arp_udp_tcp(uint8_t *mymac,uint8_t *myip,uint16_t port);
@@ -52,6 +75,7 @@ void make_udp_reply_from_request(uint8_t *buf,char *data,uint16_t datalen,uint16
 // return 0 to just continue in the packet loop and return the position 
 // of the tcp data if there is tcp data part
 uint16_t packetloop_icmp_tcp(uint8_t *buf,uint16_t plen);
+uint16_t packet_receive_fastpath(uint8_t *buf, uint16_t maxlen);
 // functions to fill the web pages with data:
 //extern uint16_t fill_tcp_data_p(uint8_t *buf,uint16_t pos, const prog_char *progmem_s);
 uint16_t fill_tcp_data(uint8_t *buf,uint16_t pos, const char *s);
@@ -195,6 +219,10 @@ uint8_t packetloop_icmp_checkreply(uint8_t *buf,uint8_t *ip_monitoredhost);
 void send_wol(uint8_t *buf,uint8_t *wolmac);
 #endif // WOL_client
 
+#ifdef IGMP_client
+void make_ip_igmp_new(uint8_t *buf, const uint8_t *dip);
+#endif // IGMP_client
+
 uint8_t nextTcpState( uint8_t *buf,uint16_t plen );
 uint8_t currentTcpState( );
 uint8_t tcpActiveOpen( uint8_t *buf,uint16_t plen,
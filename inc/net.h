@@ -121,6 +121,22 @@
 #define ICMP_IDENT_L_P 0x27
 #define ICMP_DATA_P 0x2a
 
+// ******* IGMP *******
+#define IP_PROTO_IGMP_V 2
+#define IGMP_TYPE_QUERY_V 0x11
+#define IGMP_TYPE_REPORT_V1_V 0x12
+#define IGMP_TYPE_REPORT_V2_V 0x16
+#define IGMP_TYPE_LEAVE_V 0x17
+#define IGMP_HEADER_LEN 8
+// sent with the 4 byte router alert option in the ip header
+#define IGMP_IP_HEADER_LEN 24
+#define IGMP_P 0x26
+#define IGMP_TYPE_P 0x26
+#define IGMP_MAXRESP_P 0x27
+#define IGMP_CHECKSUM_H_P 0x28
+#define IGMP_CHECKSUM_L_P 0x29
+#define IGMP_GROUP_P 0x2a
+
 // ******* UDP *******
 #define UDP_HEADER_LEN	8
 //
@@ -1,7 +1,9 @@
 #ifndef __STM32INCLUDES_H
 #define __STM32INCLUDES_H
 
-#if STM32F0
+#if ENC28J60_HOST
+#	include "enc28j60_host.h"
+#elif STM32F0
 /*#	if STM32F091xC
 #		include "stm32f091xc.h"
 #	endif*/
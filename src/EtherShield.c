@@ -57,6 +57,10 @@ The file should be extracted to the sketchbook/libraries/ folder so that there i
 	#include "dhcp.h"
 #endif
 
+#ifdef IGMP_client
+	#include "igmp.h"
+#endif
+
 #include "EtherShield.h"
 
 /**
@@ -74,28 +78,47 @@ void ES_enc28j60SpiInit(SPI_HandleTypeDef *hspi){
  * Flash the 2 MagJack LEDs
  */
 void ES_enc28j60Init( uint8_t* macaddr ) {
+  ES_enc28j60InitWithLayout( macaddr, NULL );
+}
+
+/**
+ * Same as ES_enc28j60Init with a custom split of the 8 KB buffer memory.
+ * Returns ENC28J60_LAYOUT_OK, or the error without touching the chip
+ * (ENC28J60_INIT_CLOCK: after the reset the chip clock didn't start).
+ */
+uint8_t ES_enc28j60InitWithLayout( uint8_t* macaddr, const struct enc28j60_layout *layout ) {
+  uint8_t err;
   /*initialize enc28j60*/
-  enc28j60Init( macaddr );
+  err = enc28j60InitWithLayout( macaddr, layout );
+  if (err != ENC28J60_LAYOUT_OK)
+    return err;
   enc28j60clkout(2); // change clkout from 6.25MHz to 12.5MHz
-  HAL_Delay(10);
+#if ETHERNET_FAST_INIT
+  // no LED show, the link and activity LEDs are set up right away
+  enc28j60PhyWrite(PHLCON,0x3476);
+  return ENC28J60_LAYOUT_OK;
+#else
+  enc28j60PortDelayMs(10);
 
   int f;
   for( f=0; f<3; f++ ) {
   	// 0x880 is PHLCON LEDB=on, LEDA=on
   	// enc28j60PhyWrite(PHLCON,0b0011 1000 1000 00 00);
   	enc28j60PhyWrite(PHLCON,0x3880);
-  	HAL_Delay(500);
+  	enc28j60PortDelayMs(500);
 
   	// 0x990 is PHLCON LEDB=off, LEDA=off
   	// enc28j60PhyWrite(PHLCON,0b0011 1001 1001 00 00);
   	enc28j60PhyWrite(PHLCON,0x3990);
-  	HAL_Delay(500);
+  	enc28j60PortDelayMs(500);
   }
 
   // 0x476 is PHLCON LEDA=links status, LEDB=receive/transmit
   // enc28j60PhyWrite(PHLCON,0b0011 0100 0111 01 10);
   enc28j60PhyWrite(PHLCON,0x3476);
-  HAL_Delay(100);
+  enc28j60PortDelayMs(100);
+  return ENC28J60_LAYOUT_OK;
+#endif
 }
 
 void ES_enc28j60clkout(uint8_t clk){
@@ -138,6 +161,10 @@ uint16_t ES_enc28j60PacketReceive(uint16_t len, uint8_t* packet){
 	return enc28j60PacketReceive(len, packet);
 }
 
+uint8_t ES_enc28j60PacketReceiveBatch(uint8_t count, uint16_t len, uint8_t** packets, uint16_t* lens){
+	return enc28j60PacketReceiveBatch(count, len, packets, lens);
+}
+
 void ES_enc28j60PacketSend(uint16_t len, uint8_t* packet){
 	enc28j60PacketSend(len, packet);
 }
@@ -220,6 +247,10 @@ uint16_t ES_packetloop_icmp_tcp(uint8_t *buf,uint16_t plen) {
 	return packetloop_icmp_tcp(buf,plen);
 }
 
+uint16_t ES_packet_receive_fastpath(uint8_t *buf,uint16_t len) {
+	return packet_receive_fastpath(buf,len);
+}
+
 /*uint16_t ES_fill_tcp_data_p(uint8_t *buf,uint16_t pos, const prog_char *progmem_s){
 	return fill_tcp_data_p(buf, pos, progmem_s);
 }*/
@@ -320,6 +351,16 @@ void ES_send_wol(uint8_t *buf,uint8_t *wolmac) {
 }
 #endif // WOL_client
 
+#ifdef IGMP_client
+uint8_t ES_igmp_join(uint8_t *buf, const uint8_t *group) {
+	return igmp_join(buf, group);
+}
+
+void ES_igmp_leave(uint8_t *buf, const uint8_t *group) {
+	igmp_leave(buf, group);
+}
+#endif // IGMP_client
+
 
 #ifdef FROMDECODE_websrv_help
 uint8_t ES_find_key_val(char *str,char *strbuf, uint16_t maxlen,char *key) {
@@ -384,14 +425,16 @@ uint8_t ES_udp_client_check_for_dns_answer(uint8_t *buf,uint16_t plen){
 uint8_t resolveHostname(uint8_t *buf, uint16_t buffer_size, uint8_t *hostname ) {
   uint16_t dat_p;
   int plen = 0;
-  long lastDnsRequest = HAL_GetTick();
+  long lastDnsRequest = enc28j60PortMillis();
   uint8_t dns_state = DNS_STATE_INIT;
   bool gotAddress = FALSE;
   uint8_t dnsTries = 3;	// After 10 attempts fail gracefully so other action can be carried out
 
   while( !gotAddress ) {
     // handle ping and wait for a tcp packet
-    plen = enc28j60PacketReceive(buffer_size, buf);
+    plen = packet_receive_fastpath(buf, buffer_size);
+    if (plen == 0)
+      enc28j60PortYield();
     dat_p=packetloop_icmp_tcp(buf,plen);
 
     // We have a packet
@@ -404,18 +447,18 @@ uint8_t resolveHostname(uint8_t *buf, uint16_t buffer_size, uint8_t *hostname )
       // It has IP data
       if (dns_state==DNS_STATE_INIT) {
         dns_state=DNS_STATE_REQUESTED;
-        lastDnsRequest = HAL_GetTick();
+        lastDnsRequest = enc28j60PortMillis();
         dnslkup_request(buf,hostname);
         continue;
       }
       if (dns_state!=DNS_STATE_ANSWER){
         // retry every minute if dns-lookup failed:
-        if (HAL_GetTick() > (lastDnsRequest + 60000L) ){
+        if (enc28j60PortMillis() > (lastDnsRequest + 60000L) ){
 	  if( --dnsTries <= 0 ) 
 	    return 0;		// Failed to allocate address
 
           dns_state=DNS_STATE_INIT;
-          lastDnsRequest = HAL_GetTick();
+          lastDnsRequest = enc28j60PortMillis();
         }
         // don't try to use client before
         // we have a result of dns-lookup
@@ -459,7 +502,7 @@ uint8_t ES_check_for_dhcp_answer(uint8_t *buf,uint16_t plen){
 uint8_t allocateIPAddress(uint8_t *buf, uint16_t buffer_size, uint8_t *mymac, uint16_t myport, uint8_t *myip, uint8_t *mynetmask, uint8_t *gwip, uint8_t *dnsip, uint8_t *dhcpsvrip ) {
   uint16_t dat_p;
   int plen = 0;
-  long lastDhcpRequest = HAL_GetTick();
+  long lastDhcpRequest = enc28j60PortMillis();
   uint8_t dhcpState = 0;
   bool gotIp = FALSE;
   uint8_t dhcpTries = 10;	// After 10 attempts fail gracefully so other action can be carried out
@@ -468,15 +511,17 @@ uint8_t allocateIPAddress(uint8_t *buf, uint16_t buffer_size, uint8_t *mymac, ui
 
   while( !gotIp ) {
     // handle ping and wait for a tcp packet
-    plen = enc28j60PacketReceive(buffer_size, buf);
+    plen = packet_receive_fastpath(buf, buffer_size);
+    if (plen == 0)
+      enc28j60PortYield();
     dat_p=packetloop_icmp_tcp(buf,plen);
     if(dat_p==0) {
       check_for_dhcp_answer( buf, plen);
       dhcpState = dhcp_state();
       // we are idle here
       if( dhcpState != DHCP_STATE_OK ) {
-        if (HAL_GetTick() > (lastDhcpRequest + 10000L) ){
-          lastDhcpRequest = HAL_GetTick();
+        if (enc28j60PortMillis() > (lastDhcpRequest + 10000L) ){
+          lastDhcpRequest = enc28j60PortMillis();
 	  if( --dhcpTries <= 0 ) 
 		  return 0;		// Failed to allocate address
           // send dhcp
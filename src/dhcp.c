@@ -98,7 +98,7 @@ uint8_t dhcp_state(void) {
   // leaseStart - start time in millis
   // leaseTime - length of lease in millis
   //
-  if (dhcpState == DHCP_STATE_OK && (leaseStart + leaseTime) <= HAL_GetTick()) {
+  if (dhcpState == DHCP_STATE_OK && (leaseStart + leaseTime) <= enc28j60PortMillis()) {
     // Calling app needs to detect this and init renewal
     dhcpState = DHCP_STATE_RENEW;
   }
@@ -303,7 +303,7 @@ uint8_t have_dhcpoffer(uint8_t *buf, uint16_t plen) {
 
 uint8_t have_dhcpack(uint8_t *buf, uint16_t plen) {
   dhcpState = DHCP_STATE_OK;
-  leaseStart = HAL_GetTick();
+  leaseStart = enc28j60PortMillis();
   // Turn off broadcast. Application if it needs it can re-enable it
   enc28j60DisableBroadcast();
   return 2;
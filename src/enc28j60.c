@@ -1,10 +1,54 @@
+#include <string.h>
 #include "enc28j60.h"
+#include "enc28j60_timing.h"
 #include "error_handler.h"
 
-static uint8_t Enc28j60Bank;
-static uint16_t gNextPacketPtr;
-static uint8_t erxfcon;
-static SPI_HandleTypeDef *hspi = NULL;
+// the default device, on the pins given at build time
+struct enc28j60_dev enc28j60DefaultDev = {
+	.spi = ENC28J60_SPI_DEFAULT,
+	.csPort = ETHERNET_CS_GPIO,
+	.csPin = ETHERNET_CS_PIN,
+	.ledPort = ETHERNET_LED_GPIO,
+	.ledPin = ETHERNET_LED_PIN,
+	.fullDuplex = ETHERNET_FULL_DUPLEX,
+	.rxStop = RXSTOP_INIT,
+	.txStart = TXSTART_INIT,
+	.txSlotSize = TX_SLOT_SIZE,
+	.txSlots = ETHERNET_TX_SLOTS,
+	.reservedStart = ENC28J60_BUFFER_SIZE,
+};
+// the selected device all functions work on
+static struct enc28j60_dev *dev = &enc28j60DefaultDev;
+// all devices, enc28j60DmaComplete looks up the SPI handle here
+static struct enc28j60_dev *devices = &enc28j60DefaultDev;
+
+#define disableChip do { \
+		dev->spi->release(dev); \
+		ETHERNET_CS_DELAY_PROC; \
+	} while (0)
+#define enableChip do { \
+		dev->spi->select(dev); \
+		ETHERNET_CS_DELAY_PROC; \
+	} while (0)
+
+static void enc28j60TxComplete(uint8_t eir);
+
+#if ETHERNET_INT_RX
+// Interrupt driven receive. The EXTI handler of the INT pin talks to the
+// chip only while no other access is in progress (busLock), otherwise the
+// service is deferred to the end of that access. Events go through a
+// single-producer/single-consumer ring to the main loop.
+static void enc28j60ServiceIrq(void);
+
+#define ENC28J60_LOCK() (dev->busLock++)
+#define ENC28J60_UNLOCK() do { \
+		if (--dev->busLock == 0 && dev->irqDeferred) \
+			enc28j60ServiceIrq(); \
+	} while (0)
+#else
+#define ENC28J60_LOCK()
+#define ENC28J60_UNLOCK()
+#endif
 
 #if 0
 void ENC28J60_hspi->Instance_Configuration(void)
@@ -86,125 +130,367 @@ void ENC28J60_GPIO_Configuration(void)
 
 void enc28j60_set_spi(SPI_HandleTypeDef *hspi_new)
 {
-	hspi = hspi_new;
+	dev->hspi = hspi_new;
+	dev->spi->init(dev);
+	enc28j60TimingInit();
+}
+
+// Set up another chip: its SPI handle and chip select pin, the LED is
+// optional (ledPort NULL). The device is added to the ones known to
+// enc28j60DmaComplete; select it before enc28j60Init.
+void enc28j60DevInit(struct enc28j60_dev *d, SPI_HandleTypeDef *hspi, GPIO_TypeDef *csPort, uint16_t csPin, GPIO_TypeDef *ledPort, uint16_t ledPin)
+{
+	struct enc28j60_dev *prev = dev;
+	struct enc28j60_dev *p;
+
+	memset(d, 0, sizeof(*d));
+	d->spi = ENC28J60_SPI_DEFAULT;
+	d->csPort = csPort;
+	d->csPin = csPin;
+	d->ledPort = ledPort;
+	d->ledPin = ledPin;
+	d->fullDuplex = ETHERNET_FULL_DUPLEX;
+	d->rxStop = RXSTOP_INIT;
+	d->txStart = TXSTART_INIT;
+	d->txSlotSize = TX_SLOT_SIZE;
+	d->txSlots = ETHERNET_TX_SLOTS;
+	d->reservedStart = ENC28J60_BUFFER_SIZE;
+
+	for (p = devices; p != NULL && p != d; p = p->next);
+	if (p == NULL) {
+		d->next = devices;
+		devices = d;
+	}
+
+	dev = d;
+	enc28j60_set_spi(hspi);
+	dev = prev;
+}
+
+// All driver functions work on the selected device. An interrupt or DMA
+// completion of another device selects that one only while it is handled.
+void enc28j60SelectDevice(struct enc28j60_dev *d)
+{
+	dev = d;
+}
+
+struct enc28j60_dev *enc28j60CurrentDevice(void)
+{
+	return dev;
 }
 
 void error (float error_num, char infinite);
 unsigned char ENC28J60_SendByte(uint8_t tx)
 {
-	if (hspi == NULL)
-		return 0;
-//	while(SPI_I2S_GetFlagStatus(hspi->Instance, SPI_I2S_FLAG_TXE) == RESET);
-//	SPI_WaitFlagStateUntilTimeout(hspi, SPI_FLAG_TXE, RESET, 0xffffffff);
+	uint8_t rx = 0;
 
-/*
-	//SPI_I2S_SendData(hspi->Instance, dt);
-	int r;
-	r = HAL_SPI_Transmit(hspi, &dt, 1, 0xffffffff);
-
-	if (r != HAL_OK)
-		error(r, 0);
-	//while(SPI_I2S_GetFlagStatus(hspi->Instance, SPI_I2S_FLAG_RXNE) == RESET);
-//	SPI_WaitFlagStateUntilTimeout(hspi, SPI_FLAG_RXNE, RESET, 0xffffffff);
-    
-	//return SPI_I2S_ReceiveData(hspi->Instance);
-	r = HAL_SPI_Receive(hspi, &dt, 1, 0xffffffff);
-
-	if (r != HAL_OK)
-		error(r, 0);
-*/
+	dev->spi->transfer(dev, &tx, &rx, 1);
+	return rx;
+}
 
-	uint8_t rx = 0;
-	int r;
+#if ETHERNET_SPI_DMA
+// Finish a DMA transfer: release CS and notify the owner of the transfer.
+// Called either from the HAL completion interrupt (see enc28j60DmaComplete)
+// or when polling notices that the transport is done, whichever comes first.
+static void enc28j60DmaFinish(void)
+{
+	enc28j60_dma_callback callback;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if (!dev->dmaBusy) {
+		__set_PRIMASK(primask);
+		return;
+	}
+	disableChip;
+	callback = dev->dmaCallback;
+	dev->dmaCallback = NULL;
+	dev->dmaBusy = 0;
+	__set_PRIMASK(primask);
+
+	if (callback)
+		callback();
+}
 
-	r = HAL_SPI_TransmitReceive(hspi, &tx, &rx, 1, 0xffffffff);
+// Start a buffer memory transfer on the DMA. CS stays asserted until the
+// transfer is finished.
+static void enc28j60DmaStart(uint8_t op, uint16_t len, uint8_t* data, enc28j60_dma_callback callback)
+{
+	uint8_t r;
+
+	enableChip;
+	ENC28J60_SendByte(op);
+	dev->dmaCallback = callback;
+	dev->dmaBusy = 1;
+	if (op == ENC28J60_READ_BUF_MEM)
+		r = dev->spi->readAsync(dev, data, len);
+	else
+		r = dev->spi->writeAsync(dev, data, len);
 
-	if (r != HAL_OK)
+	if (r != 0) {
+		dev->dmaCallback = NULL;
+		dev->dmaBusy = 0;
+		disableChip;
 		ENC28j60_Error_Handler(SPI_ERROR);
+	}
+}
 
-	return rx;
+uint8_t enc28j60DmaBusy(void)
+{
+	if (dev->dmaBusy && !dev->spi->asyncBusy(dev))
+		enc28j60DmaFinish();
+	return dev->dmaBusy;
+}
+
+void enc28j60DmaComplete(SPI_HandleTypeDef *hspi_done)
+{
+	struct enc28j60_dev *prev = dev;
+	struct enc28j60_dev *p;
+
+	for (p = devices; p != NULL; p = p->next) {
+		if (p->hspi == hspi_done) {
+			dev = p;
+			enc28j60DmaFinish();
+			break;
+		}
+	}
+	dev = prev;
+}
+
+// every access to the chip must wait for a running DMA transfer first
+static inline void enc28j60DmaWait(void)
+{
+	while (enc28j60DmaBusy())
+		enc28j60PortYield();
+}
+#else
+uint8_t enc28j60DmaBusy(void)
+{
+	return 0;
+}
+
+void enc28j60DmaComplete(SPI_HandleTypeDef *hspi_done)
+{
+	(void)hspi_done;
+}
+
+static inline void enc28j60DmaWait(void)
+{
+}
+#endif
+
+// Replace the transport of the selected device, e.g. a board specific
+// backend or enc28j60SpiHal where the register-level access doesn't fit.
+void enc28j60SetTransport(const struct enc28j60_spi_ops *ops, void *ctx)
+{
+	enc28j60DmaWait();
+	dev->spi = ops;
+	dev->spiCtx = ctx;
+	dev->spi->init(dev);
+	enc28j60TimingInit();
 }
 
 uint8_t enc28j60ReadOp(uint8_t op, uint8_t address)
 {
-		uint8_t temp;
-        enableChip;
-        // issue read command
-        ENC28J60_SendByte(op | (address & ADDR_MASK));
-        temp = ENC28J60_SendByte(0xFF);
-        if (address & 0x80)
-            temp = ENC28J60_SendByte(0xFF);
+        // MAC and MII registers send a dummy byte first
+        uint8_t tx[3] = {op | (address & ADDR_MASK), 0xFF, 0xFF};
+        uint8_t rx[3] = {0, 0, 0};
+        uint8_t len = (address & 0x80) ? 3 : 2;
 
+        enc28j60DmaWait();
+        ENC28J60_LOCK();
+        enableChip;
+        // issue read command, the data comes with the last byte
+        dev->spi->transfer(dev, tx, rx, len);
+        // MAC and MII registers need a longer CS hold time
+        if (address & 0x80) {
+            ETHERNET_CS_HOLD_PROC;
+        }
         // release CS
         disableChip;
-        return temp;
+        ENC28J60_UNLOCK();
+        return rx[len - 1];
 }
 
 void enc28j60WriteOp(uint8_t op, uint8_t address, uint8_t data)
 {
+    uint8_t tx[2] = {op | (address & ADDR_MASK), data};
+
+    enc28j60DmaWait();
+    ENC28J60_LOCK();
     enableChip;
-    ENC28J60_SendByte(op | (address & ADDR_MASK));
-    ENC28J60_SendByte(data);
+    // nothing useful comes back on MISO
+    dev->spi->transfer(dev, tx, NULL, 2);
     disableChip;
+    ENC28J60_UNLOCK();
 }
 
 void enc28j60PowerDown() {
  enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXEN);
- while(enc28j60Read(ESTAT) & ESTAT_RXBUSY);
- while(enc28j60Read(ECON1) & ECON1_TXRTS);
+ while(enc28j60Read(ESTAT) & ESTAT_RXBUSY)
+  enc28j60PortYield();
+ while(enc28j60Read(ECON1) & ECON1_TXRTS)
+  enc28j60PortYield();
  enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PWRSV);
 }
 
 void enc28j60PowerUp() {
  enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON2, ECON2_PWRSV);
- while(!enc28j60Read(ESTAT) & ESTAT_CLKRDY);
+ while(!enc28j60Read(ESTAT) & ESTAT_CLKRDY)
+  enc28j60PortYield();
 }
 
 
 void enc28j60ReadBuffer(uint16_t len, uint8_t* data)
 {
+    enc28j60DmaWait();
+#if ETHERNET_SPI_DMA
+    if (len >= ETHERNET_SPI_DMA_MIN_LEN && dev->spi->readAsync != NULL) {
+        enc28j60DmaStart(ENC28J60_READ_BUF_MEM, len, data, NULL);
+        enc28j60DmaWait();
+        return;
+    }
+#endif
+    ENC28J60_LOCK();
     enableChip;
     ENC28J60_SendByte(ENC28J60_READ_BUF_MEM);
-    while (len--) {
-        *data++ = ENC28J60_SendByte(0x00);
-    }
+    dev->spi->read(dev, data, len);
     disableChip;
+    ENC28J60_UNLOCK();
     // Remove next line suggested by user epam - not needed
 //    *data='\0';
 }
 
-static uint16_t enc28j60ReadBufferWord() {
-    uint16_t result;
-    enc28j60ReadBuffer(2, (uint8_t*) &result);
-    return result;
-}
-
 
 void enc28j60WriteBuffer(uint16_t len, uint8_t* data)
 {
+    enc28j60DmaWait();
+#if ETHERNET_SPI_DMA
+    if (len >= ETHERNET_SPI_DMA_MIN_LEN && dev->spi->writeAsync != NULL) {
+        enc28j60DmaStart(ENC28J60_WRITE_BUF_MEM, len, data, NULL);
+        enc28j60DmaWait();
+        return;
+    }
+#endif
+    ENC28J60_LOCK();
     enableChip;
     ENC28J60_SendByte(ENC28J60_WRITE_BUF_MEM);
-    while (len--)
-        ENC28J60_SendByte(*data++);
-
+    dev->spi->write(dev, data, len);
     disableChip;
+    ENC28J60_UNLOCK();
+}
+
+// Asynchronous variants: the transfer runs on the DMA and callback is
+// invoked once it is finished and CS is released, so the caller can parse
+// the previous frame meanwhile. The data buffer must stay valid until then.
+// Any other access to the chip waits for the transfer to finish.
+// Without ETHERNET_SPI_DMA the transfer is done synchronously.
+void enc28j60ReadBufferAsync(uint16_t len, uint8_t* data, enc28j60_dma_callback callback)
+{
+#if ETHERNET_SPI_DMA
+    enc28j60DmaWait();
+    if (dev->spi->readAsync != NULL) {
+        enc28j60DmaStart(ENC28J60_READ_BUF_MEM, len, data, callback);
+        return;
+    }
+#endif
+    enc28j60ReadBuffer(len, data);
+    if (callback)
+        callback();
+}
+
+void enc28j60WriteBufferAsync(uint16_t len, uint8_t* data, enc28j60_dma_callback callback)
+{
+#if ETHERNET_SPI_DMA
+    enc28j60DmaWait();
+    if (dev->spi->writeAsync != NULL) {
+        enc28j60DmaStart(ENC28J60_WRITE_BUF_MEM, len, data, callback);
+        return;
+    }
+#endif
+    enc28j60WriteBuffer(len, data);
+    if (callback)
+        callback();
 }
 
+// EIE, EIR, ESTAT, ECON2 and ECON1 are in every bank
+#define ENC28J60_ALL_BANKS(address) (((address) & ADDR_MASK) >= EIE)
+
 void enc28j60SetBank(uint8_t address)
 {
-    if ((address & BANK_MASK) != Enc28j60Bank) {
+    uint8_t bank = address & BANK_MASK;
+
+    if (ENC28J60_ALL_BANKS(address) || bank == dev->bank)
+        return;
+    ENC28J60_LOCK();
+    // ECON1 is never written whole (TXRTS, DMAST), but when the new bank
+    // only needs BSEL bits set or only cleared one operation does it
+    if ((bank & dev->bank) == dev->bank) {
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, bank>>5);
+    } else if ((bank & dev->bank) == bank) {
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, (dev->bank & ~bank)>>5);
+    } else {
         enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_BSEL1|ECON1_BSEL0);
-        Enc28j60Bank = address & BANK_MASK;
-        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, Enc28j60Bank>>5);
+        enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, bank>>5);
     }
+    dev->bank = bank;
+    ENC28J60_UNLOCK();
+}
+
+// One register access of a batch, in the bank that is selected
+static void enc28j60RegOp(struct enc28j60_reg *reg)
+{
+	if (reg->op == ENC28J60_READ_CTRL_REG)
+		reg->data = enc28j60ReadOp(ENC28J60_READ_CTRL_REG, reg->address);
+	else
+		enc28j60WriteOp(reg->op, reg->address, reg->data);
+}
+
+// Perform count register accesses with as few bank switches as possible.
+// Accesses to the all-bank registers keep their place in the sequence and
+// need no bank. Between them the banked accesses are grouped by bank,
+// starting with the selected one; accesses to the same bank keep their
+// order (ERXRDPT, MIWR and the like are written low byte first).
+void enc28j60RegBatch(struct enc28j60_reg *regs, uint8_t count)
+{
+	uint8_t i = 0, end, j, n, first, bank, banks;
+
+	ENC28J60_LOCK();
+	while (i < count) {
+		// the banked accesses up to the next all-bank register
+		banks = 0;
+		for (end = i; end < count && !ENC28J60_ALL_BANKS(regs[end].address); end++)
+			banks |= 1 << ((regs[end].address & BANK_MASK) >> 5);
+		// the selected bank first, then the following ones
+		first = dev->bank;
+		for (n = 0; n < 4 && banks; n++) {
+			bank = (first + (n << 5)) & BANK_MASK;
+			if (!(banks & (1 << (bank >> 5))))
+				continue;
+			banks &= ~(1 << (bank >> 5));
+			enc28j60SetBank(bank);
+			for (j = i; j < end; j++) {
+				if ((regs[j].address & BANK_MASK) == bank)
+					enc28j60RegOp(&regs[j]);
+			}
+		}
+		if (end < count)
+			enc28j60RegOp(&regs[end++]);
+		i = end;
+	}
+	ENC28J60_UNLOCK();
 }
 
 uint8_t enc28j60Read(uint8_t address)
 {
+        uint8_t data;
+        ENC28J60_LOCK();
         // set the bank
         enc28j60SetBank(address);
         // do the read
-        return enc28j60ReadOp(ENC28J60_READ_CTRL_REG, address);
+        data = enc28j60ReadOp(ENC28J60_READ_CTRL_REG, address);
+        ENC28J60_UNLOCK();
+        return data;
 }
 
 void enc28j60WriteWord(uint8_t address, uint16_t data) {
@@ -212,44 +498,99 @@ void enc28j60WriteWord(uint8_t address, uint16_t data) {
     enc28j60Write(address + 1, data >> 8);
 }
 
-// read upper 8 bits
-uint16_t enc28j60PhyReadH(uint8_t address)
+// Non-blocking PHY access through the MII: start a read or write, then
+// call enc28j60PhyPoll until it returns ENC28J60_PHY_DONE. An operation
+// takes about 10 us, there is nothing to sleep for.
+uint8_t enc28j60PhyStartRead(uint8_t address)
 {
+	if (dev->phyOp != ENC28J60_PHY_IDLE)
+		return 0;
 	// Set the right address and start the register read operation
 	enc28j60Write(MIREGADR, address);
 	enc28j60Write(MICMD, MICMD_MIIRD);
-	Delay(15);
+	dev->phyOp = ENC28J60_PHY_READ;
+	return 1;
+}
+
+uint8_t enc28j60PhyStartWrite(uint8_t address, uint16_t data)
+{
+	if (dev->phyOp != ENC28J60_PHY_IDLE)
+		return 0;
+	// set the PHY register address
+	enc28j60Write(MIREGADR, address);
+	// write the PHY data, writing MIWRH starts the operation
+	enc28j60Write(MIWRL, data);
+	enc28j60Write(MIWRH, data>>8);
+	dev->phyOp = ENC28J60_PHY_WRITE;
+	// enc28j60Recover sets the LEDs up again
+	if (address == PHLCON)
+		dev->phlcon = data;
+	return 1;
+}
+
+// ENC28J60_PHY_BUSY while the operation runs, ENC28J60_PHY_DONE once (with
+// the register value in *data after a read), ENC28J60_PHY_IDLE if nothing
+// was started
+uint8_t enc28j60PhyPoll(uint16_t *data)
+{
+	uint8_t op = dev->phyOp;
+
+	if (op == ENC28J60_PHY_IDLE)
+		return ENC28J60_PHY_IDLE;
+	if (enc28j60Read(MISTAT) & MISTAT_BUSY)
+		return ENC28J60_PHY_BUSY;
+	if (op == ENC28J60_PHY_READ) {
+		// reset reading bit
+		enc28j60Write(MICMD, 0x00);
+		if (data) {
+			*data = enc28j60Read(MIRDL);
+			*data |= (uint16_t)enc28j60Read(MIRDH) << 8;
+		}
+	}
+	dev->phyOp = ENC28J60_PHY_IDLE;
+	return ENC28J60_PHY_DONE;
+}
+
+uint16_t enc28j60PhyRead(uint8_t address)
+{
+	uint16_t data = 0;
 
+	// finish whatever is running
+	while (enc28j60PhyPoll(NULL) == ENC28J60_PHY_BUSY)
+		enc28j60PortYield();
+	enc28j60PhyStartRead(address);
 	// wait until the PHY read completes
-	while(enc28j60Read(MISTAT) & MISTAT_BUSY);
+	while (enc28j60PhyPoll(&data) == ENC28J60_PHY_BUSY)
+		enc28j60PortYield();
+	return data;
+}
 
-	// reset reading bit
-	enc28j60Write(MICMD, 0x00);
-	
-	return (enc28j60Read(MIRDH));
+// read upper 8 bits
+uint16_t enc28j60PhyReadH(uint8_t address)
+{
+	return enc28j60PhyRead(address) >> 8;
 }
 
 
 void enc28j60Write(uint8_t address, uint8_t data)
 {
+        ENC28J60_LOCK();
         // set the bank
         enc28j60SetBank(address);
         // do the write
         enc28j60WriteOp(ENC28J60_WRITE_CTRL_REG, address, data);
+        ENC28J60_UNLOCK();
 }
 
 
 void enc28j60PhyWrite(uint8_t address, uint16_t data)
 {
-        // set the PHY register address
-        enc28j60Write(MIREGADR, address);
-        // write the PHY data
-        enc28j60Write(MIWRL, data);
-        enc28j60Write(MIWRH, data>>8);
+        while (enc28j60PhyPoll(NULL) == ENC28J60_PHY_BUSY)
+                enc28j60PortYield();
+        enc28j60PhyStartWrite(address, data);
         // wait until the PHY write completes
-        while(enc28j60Read(MISTAT) & MISTAT_BUSY){
-                Delay(15);
-        }
+        while (enc28j60PhyPoll(NULL) == ENC28J60_PHY_BUSY)
+                enc28j60PortYield();
 }
 /*
 static void enc28j60PhyWriteWord(byte address, word data) {
@@ -266,32 +607,327 @@ void enc28j60clkout(uint8_t clk)
 	enc28j60Write(ECOCON, clk & 0x7);
 }
 
+// MAC and PHY settings of a duplex mode, they have to agree (datasheet 6.5)
+static void enc28j60DuplexConfig(uint8_t full)
+{
+	dev->fullDuplex = full;
+	// MACON3 doesn't take bit field set/clear, it is always written whole:
+	// automatic padding to 60 bytes and CRC operations
+	if (full) {
+		enc28j60Write(MACON3, MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN|MACON3_FULDPX);
+		// set inter-frame gap (back-to-back)
+		enc28j60Write(MABBIPG, 0x15);
+		// set inter-frame gap (non-back-to-back), MAIPGH is unused
+		enc28j60WriteWord(MAIPGL, 0x0012);
+	} else {
+		enc28j60Write(MACON3, MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN);
+		enc28j60Write(MABBIPG, 0x12);
+		enc28j60WriteWord(MAIPGL, 0x0C12);
+	}
+	// the PHY write runs while the bank 3 registers are set
+	while (enc28j60PhyPoll(NULL) == ENC28J60_PHY_BUSY)
+		enc28j60PortYield();
+	enc28j60PhyStartWrite(PHCON1, full ? PHCON1_PDPXMD : 0);
+	// flow control stays off until enc28j60FlowControl asks for it
+	enc28j60WriteWord(EPAUSL, ETHERNET_PAUSE_TIME);
+	enc28j60Write(EFLOCON, 0);
+	while (enc28j60PhyPoll(NULL) == ENC28J60_PHY_BUSY)
+		enc28j60PortYield();
+}
+
+static uint8_t enc28j60CheckLayout(const struct enc28j60_layout *layout)
+{
+	// ERXND = rxSize-1 has to be odd, the read pointer is set to it when
+	// wrapping and must never be even (errata 13)
+	if (layout->rxSize < ENC28J60_RX_MIN || (layout->rxSize & 1))
+		return ENC28J60_LAYOUT_RX;
+	if (layout->txSlots == 0 || layout->txSlots > ENC28J60_TX_SLOTS_MAX
+			|| layout->txSlotSize < ENC28J60_TX_SLOT_MIN)
+		return ENC28J60_LAYOUT_TX;
+	if ((uint32_t)layout->rxSize + (uint32_t)layout->txSlots * layout->txSlotSize
+			+ layout->reserved > ENC28J60_BUFFER_SIZE)
+		return ENC28J60_LAYOUT_SIZE;
+	return ENC28J60_LAYOUT_OK;
+}
+
+// CLKRDY timeout in ms, the oscillator start-up timer takes 300 us
+#define ENC28J60_CLKRDY_TIMEOUT 10
+
+// Wait until the chip clock runs. Returns 0 after ENC28J60_CLKRDY_TIMEOUT.
+static uint8_t enc28j60WaitClkRdy(void)
+{
+	uint32_t start = enc28j60PortMillis();
+
+	while (!(enc28j60Read(ESTAT) & ESTAT_CLKRDY)) {
+		if (enc28j60PortMillis() - start > ENC28J60_CLKRDY_TIMEOUT)
+			return 0;
+		enc28j60PortYield();
+	}
+	return 1;
+}
+
+// PKTIF is not reliable, see Rev. B4 Silicon Errata point 6. EPKTCNT is
+// in bank 1.
+static uint8_t enc28j60RxCountPoll(uint8_t want)
+{
+	(void)want;
+	return enc28j60Read(EPKTCNT);
+}
+
+// EIR is in every bank, so a single frame is found without leaving the
+// bank the receive buffer is read in. EPKTCNT only for more.
+static uint8_t enc28j60RxCountPktif(uint8_t want)
+{
+	if (!(enc28j60ReadOp(ENC28J60_READ_CTRL_REG, EIR) & EIR_PKTIF))
+		return 0;
+	if (want <= 1)
+		return 1;
+	return enc28j60Read(EPKTCNT);
+}
+
+static uint16_t enc28j60RxReleaseOdd(void)
+{
+  // However, compensate for the errata point 13, rev B4: enver write an even address!
+  if ((dev->nextPacketPtr - 1 < RXSTART_INIT)
+          || (dev->nextPacketPtr -1 > dev->rxStop)) {
+    return dev->rxStop;
+  }
+  return dev->nextPacketPtr-1;
+}
+
+static uint16_t enc28j60RxReleaseNext(void)
+{
+	return dev->nextPacketPtr;
+}
+
+// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
+static void enc28j60TxReset(void)
+{
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+}
+
+static void enc28j60TxErrorNone(void)
+{
+}
+
+// The errata sheet lists the workarounds for all released revisions, the
+// cheaper paths only run on an entry added by enc28j60AddRevision.
+static const struct enc28j60_rev enc28j60Revs[] = {
+	{ 0x02, "B1", ENC28J60_ERRATA_ALL, enc28j60RxCountPoll, enc28j60RxReleaseOdd, enc28j60TxReset },
+	{ 0x04, "B4", ENC28J60_ERRATA_ALL, enc28j60RxCountPoll, enc28j60RxReleaseOdd, enc28j60TxReset },
+	{ 0x05, "B5", ENC28J60_ERRATA_ALL, enc28j60RxCountPoll, enc28j60RxReleaseOdd, enc28j60TxReset },
+	// microchip didn't step the number for B7
+	{ 0x06, "B7", ENC28J60_ERRATA_ALL, enc28j60RxCountPoll, enc28j60RxReleaseOdd, enc28j60TxReset },
+};
+
+// Any other EREVID, 0 and 0xff (no answer from the chip) or a misread one
+// included: no silicon after B7 exists, so keep all the workarounds.
+static const struct enc28j60_rev enc28j60RevEarly =
+	{ 0, "?", ENC28J60_ERRATA_ALL, enc28j60RxCountPoll, enc28j60RxReleaseOdd, enc28j60TxReset };
+
+// the entry of enc28j60AddRevision, unused while name is NULL
+static struct enc28j60_rev enc28j60RevAdded;
+
+void enc28j60AddRevision(uint8_t erevid, const char *name, uint8_t errata)
+{
+	enc28j60RevAdded.erevid = erevid;
+	enc28j60RevAdded.name = name;
+	enc28j60RevAdded.errata = errata;
+	enc28j60RevAdded.rxCount = (errata & ENC28J60_ERRATA_PKTIF) ? enc28j60RxCountPoll : enc28j60RxCountPktif;
+	enc28j60RevAdded.rxReleasePtr = (errata & ENC28J60_ERRATA_RDPT) ? enc28j60RxReleaseOdd : enc28j60RxReleaseNext;
+	enc28j60RevAdded.txError = (errata & ENC28J60_ERRATA_TXRST) ? enc28j60TxReset : enc28j60TxErrorNone;
+}
+
+static const struct enc28j60_rev *enc28j60RevLookup(uint8_t erevid)
+{
+	uint8_t i;
+
+	if (enc28j60RevAdded.name && enc28j60RevAdded.erevid == erevid)
+		return &enc28j60RevAdded;
+	for (i = 0; i < sizeof(enc28j60Revs) / sizeof(enc28j60Revs[0]); i++) {
+		if (enc28j60Revs[i].erevid == erevid)
+			return &enc28j60Revs[i];
+	}
+	return &enc28j60RevEarly;
+}
+
+// the workarounds for every revision until the chip has been looked at
+static const struct enc28j60_rev *enc28j60Rev(void)
+{
+	return dev->rev ? dev->rev : &enc28j60RevEarly;
+}
+
+const struct enc28j60_rev *enc28j60GetRevision(void)
+{
+	return enc28j60Rev();
+}
+
+// Soft reset, returns when the chip can be set up. The fast way waits for
+// the chip clock only as long as needed, it returns 0 if it didn't come.
+static uint8_t enc28j60Reset(uint8_t fast)
+{
+	uint32_t start;
+	uint8_t rev = 0;
+
+	// CLKRDY works after power on, so the revision can be read before
+	if (fast) {
+		enc28j60WaitClkRdy();
+		rev = enc28j60Read(EREVID);
+	}
+	enc28j60WriteOp(ENC28J60_SOFT_RESET, 0, ENC28J60_SOFT_RESET);
+	// the reset selects bank 0 and ends a PHY operation
+	dev->bank = 0;
+	dev->phyOp = ENC28J60_PHY_IDLE;
+	if (!fast) {
+		// The CLKRDY does not work. See Rev. B4 Silicon Errata point. Just wait.
+		enc28j60PortDelayMs(50);
+		return 1;
+	}
+	// the soft reset stops the clock without clearing CLKRDY (errata item 2)
+	if (enc28j60RevLookup(rev)->errata & ENC28J60_ERRATA_CLKRDY) {
+		start = enc28j60PortMicros();
+		while (enc28j60PortMicros() - start < 1000)
+			enc28j60PortYield();
+		return 1;
+	}
+	return enc28j60WaitClkRdy();
+}
+
+// Program the chip after the soft reset from dev: receive buffer,
+// filters, MAC, PHY and interrupts. Returns EREVID.
+static uint8_t enc28j60Setup(void)
+{
+	uint8_t i, n, rev;
+
+	dev->nextPacketPtr = RXSTART_INIT;
+	dev->rxOverflow = dev->rxPaused = 0;
+	dev->rxResetsInRow = dev->txTimeoutsInRow = 0;
+	dev->txHead = dev->txTail = dev->txCount = dev->txActive = 0;
+	{
+		// the batch goes bank by bank: 0, 1, 2
+		struct enc28j60_reg fixed[] = {
+			// receive buffer and the first transmit slot, 16-bit
+			// registers are written low byte first
+			ENC28J60_REG_WRITE16(ERXSTL, RXSTART_INIT),
+			ENC28J60_REG_WRITE16(ERXRDPTL, RXSTART_INIT),
+			ENC28J60_REG_WRITE16(ERXNDL, dev->rxStop),
+			ENC28J60_REG_WRITE16(ETXSTL, dev->txStart),
+			ENC28J60_REG_WRITE16(ETXNDL, dev->txStart + dev->txSlotSize - 1),
+			ENC28J60_REG_WRITE(ERXFCON, dev->erxfcon),
+			ENC28J60_REG_WRITE16(EPMCSL, dev->patternSum),
+			// enable MAC receive
+			ENC28J60_REG_WRITE(MACON1, MACON1_MARXEN|MACON1_TXPAUS|MACON1_RXPAUS),
+			// bring MAC out of reset
+			ENC28J60_REG_WRITE(MACON2, 0x00),
+			// Set the maximum packet size which the controller will accept
+			// Do not send packets longer than MAX_FRAMELEN:
+			ENC28J60_REG_WRITE16(MAMXFLL, MAX_FRAMELEN),
+		};
+		// and the pattern and hash registers that aren't 0 like after the reset
+		struct enc28j60_reg setup[sizeof(fixed) / sizeof(fixed[0]) + 18];
+
+		memcpy(setup, fixed, sizeof(fixed));
+		n = sizeof(fixed) / sizeof(fixed[0]);
+		for (i = 0; i < 8; i++) {
+			if (dev->patternMask[i])
+				setup[n++] = (struct enc28j60_reg)ENC28J60_REG_WRITE(EPMM0 + i, dev->patternMask[i]);
+			if (dev->hashTable[i])
+				setup[n++] = (struct enc28j60_reg)ENC28J60_REG_WRITE(EHT0 + i, dev->hashTable[i]);
+		}
+		if (dev->patternOffset) {
+			setup[n++] = (struct enc28j60_reg)ENC28J60_REG_WRITE(EPMOL, dev->patternOffset & 0xff);
+			setup[n++] = (struct enc28j60_reg)ENC28J60_REG_WRITE(EPMOH, dev->patternOffset >> 8);
+		}
+		enc28j60RegBatch(setup, n);
+	}
+	// padding, CRC, inter-frame gaps, PHY duplex and flow control (bank 2, 3)
+	enc28j60DuplexConfig(dev->fullDuplex);
+	{
+		// NOTE: MAC address in ENC28J60 is byte-backward (bank 3)
+		struct enc28j60_reg mac[] = {
+			// the revision decides the receive and transmit paths
+			ENC28J60_REG_READ(EREVID),
+			ENC28J60_REG_WRITE(MAADR5, dev->mac[0]),
+			ENC28J60_REG_WRITE(MAADR4, dev->mac[1]),
+			ENC28J60_REG_WRITE(MAADR3, dev->mac[2]),
+			ENC28J60_REG_WRITE(MAADR2, dev->mac[3]),
+			ENC28J60_REG_WRITE(MAADR1, dev->mac[4]),
+			ENC28J60_REG_WRITE(MAADR0, dev->mac[5]),
+		};
+		enc28j60RegBatch(mac, sizeof(mac) / sizeof(mac[0]));
+		rev = mac[0].data;
+		dev->rev = enc28j60RevLookup(rev);
+	}
+	// no loopback of transmitted frames
+	enc28j60PhyWrite(PHCON2, PHCON2_HDLDIS);
+	// link change interrupts of the PHY, they set LINKIF
+	enc28j60PhyWrite(PHIE, PHIE_PGEIE|PHIE_PLNKIE);
+	// the LEDs as the application set them
+	if (dev->phlcon)
+		enc28j60PhyWrite(PHLCON, dev->phlcon);
+	dev->linkValid = 0;
+#if ETHERNET_INT_RX
+	dev->eventHead = dev->eventTail = 0;
+	dev->irqDeferred = 0;
+	// check the receive buffer once, the interrupt may have been missed
+	dev->rxPending = 1;
+#endif
+	// enable interrutps
+#if ETHERNET_INT_RX
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE|EIE_PKTIE|EIE_LINKIE|EIE_RXERIE|EIE_TXIE|EIE_TXERIE);
+#else
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE|EIE_PKTIE);
+#endif
+	// enable packet reception
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+	return rev;
+}
+
+
 void enc28j60Init( uint8_t* macaddr )
 {
+	enc28j60InitWithLayout(macaddr, NULL);
+}
+
+// Initialise with the given buffer memory layout, NULL for the default one.
+// Returns ENC28J60_LAYOUT_OK or the reason the layout was rejected, the chip
+// is not touched then. ENC28J60_INIT_CLOCK if the chip clock didn't start
+// after the reset, the chip is not set up then.
+uint8_t enc28j60InitWithLayout(uint8_t* macaddr, const struct enc28j60_layout *layout)
+{
+	dev->initStart = enc28j60PortMicros();
+	if (layout) {
+		uint8_t err = enc28j60CheckLayout(layout);
+		if (err != ENC28J60_LAYOUT_OK)
+			return err;
+		dev->rxStop = layout->rxSize - 1;
+		dev->txStart = layout->rxSize;
+		dev->txSlots = layout->txSlots;
+		dev->txSlotSize = layout->txSlotSize;
+		dev->reservedStart = dev->txStart + dev->txSlots * dev->txSlotSize;
+	} else {
+		dev->rxStop = RXSTOP_INIT;
+		dev->txStart = TXSTART_INIT;
+		dev->txSlots = ETHERNET_TX_SLOTS;
+		dev->txSlotSize = TX_SLOT_SIZE;
+		dev->reservedStart = ENC28J60_BUFFER_SIZE;
+	}
+
 	enableChip; // ss=0
 
+	memcpy(dev->mac, macaddr, sizeof(dev->mac));
+	memset(dev->hashTable, 0, sizeof(dev->hashTable));
+	dev->phlcon = 0;
+	dev->recoverPending = 0;
 	// perform system reset
-	enc28j60WriteOp(ENC28J60_SOFT_RESET, 0, ENC28J60_SOFT_RESET);
-	HAL_Delay(50);
-	// check CLKRDY bit to see if reset is complete
-        // The CLKRDY does not work. See Rev. B4 Silicon Errata point. Just wait.
-	//while(!(enc28j60Read(ESTAT) & ESTAT_CLKRDY));
-	// do bank 0 stuff
-	// initialize receive buffer
-	// 16-bit transfers, must write low byte first
-	// set receive buffer start address
-	gNextPacketPtr = RXSTART_INIT;
-        // Rx start
-	enc28j60WriteWord(ERXSTL, RXSTART_INIT);
-	// set receive pointer address
-	enc28j60WriteWord(ERXRDPTL, RXSTART_INIT);
-	// RX end
-	enc28j60WriteWord(ERXNDL, RXSTOP_INIT);
-	// TX start
-	enc28j60WriteWord(ETXSTL, TXSTART_INIT);
-	// TX end
-	enc28j60WriteWord(ETXNDL, TXSTOP_INIT);
-	// do bank 1 stuff, packet filter:
+	if (!enc28j60Reset(ETHERNET_FAST_INIT)) {
+		// the clock is late, give it the 50 ms of the slow way
+		enc28j60PortDelayMs(50);
+		if (!enc28j60WaitClkRdy())
+			return ENC28J60_INIT_CLOCK;
+	}
+	// packet filter:
         // For broadcast packets we allow only ARP packtets
         // All other packets should be unicast only for our mac (MAADR)
         //
@@ -301,46 +937,97 @@ void enc28j60Init( uint8_t* macaddr )
         // 06 08 -- ff ff ff ff ff ff -> ip checksum for theses bytes=f7f9
         // in binary these poitions are:11 0000 0011 1111
         // This is hex 303F->EPMM0=0x3f,EPMM1=0x30
- 
-	//enc28j60Write(ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN);
         //Change to add ERXFCON_BCEN recommended by epam
-	//enc28j60Write(ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN|ERXFCON_BCEN);
-        erxfcon =  ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN|ERXFCON_BCEN;
-	enc28j60Write(ERXFCON, erxfcon );
-	enc28j60WriteWord(EPMM0, 0x303f);
-	enc28j60WriteWord(EPMCSL, 0xf7f9);
-        //
-	// do bank 2 stuff
-	// enable MAC receive
-	enc28j60Write(MACON1, MACON1_MARXEN|MACON1_TXPAUS|MACON1_RXPAUS);
-	// bring MAC out of reset
-	enc28j60Write(MACON2, 0x00);
-	// enable automatic padding to 60bytes and CRC operations
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, MACON3, MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN);  //|MACON3_FULDPX);
-	// set inter-frame gap (non-back-to-back)
-	enc28j60WriteWord(MAIPGL, 0x0C12);
-	// set inter-frame gap (back-to-back)
-	enc28j60Write(MABBIPG, 0x12);
-	// Set the maximum packet size which the controller will accept
-        // Do not send packets longer than MAX_FRAMELEN:
-	enc28j60WriteWord(MAMXFLL, MAX_FRAMELEN);	
-	// do bank 3 stuff
-        // write MAC address
-        // NOTE: MAC address in ENC28J60 is byte-backward
-  enc28j60Write(MAADR5, macaddr[0]);
-  enc28j60Write(MAADR4, macaddr[1]);
-  enc28j60Write(MAADR3, macaddr[2]);
-  enc28j60Write(MAADR2, macaddr[3]);
-  enc28j60Write(MAADR1, macaddr[4]);
-  enc28j60Write(MAADR0, macaddr[5]);
-	// no loopback of transmitted frames
-	enc28j60PhyWrite(PHCON2, PHCON2_HDLDIS);
-	// switch to bank 0
-	enc28j60SetBank(ECON1);
-	// enable interrutps
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE|EIE_PKTIE);
-	// enable packet reception
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+        dev->erxfcon =  ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN|ERXFCON_BCEN;
+	memset(dev->patternMask, 0, sizeof(dev->patternMask));
+	dev->patternMask[0] = 0x3f;
+	dev->patternMask[1] = 0x30;
+	dev->patternOffset = 0;
+	dev->patternSum = 0xf7f9;
+	enc28j60Setup();
+	dev->stats.initUs = enc28j60PortMicros() - dev->initStart;
+	dev->stats.firstRxUs = 0;
+	return ENC28J60_LAYOUT_OK;
+}
+
+// recoverPending bit of a recovery that failed and is tried again
+#define ENC28J60_RECOVER_RETRY 0x80
+
+void enc28j60RequestRecovery(enum ENC28j60_Error error)
+{
+	dev->recoverPending |= 1 << error;
+}
+
+uint8_t enc28j60Recover(void)
+{
+	uint32_t start = enc28j60PortMicros();
+	uint8_t pending = dev->recoverPending;
+	uint8_t rev = 0;
+
+	dev->recoverPending = 0;
+	dev->stats.txErrors += dev->txCount;
+	ENC28J60_LOCK();
+	// always the fast way, the errata wait is 1 ms
+	if (enc28j60Reset(1))
+		rev = enc28j60Setup();
+	ENC28J60_UNLOCK();
+	// 0 or 0xff is no answer from the chip, try again later
+	if (rev == 0 || rev == 0xff) {
+		dev->recoverPending = pending | ENC28J60_RECOVER_RETRY;
+		dev->recoverTick = enc28j60PortMillis();
+		dev->stats.recoverFailed++;
+		return 0;
+	}
+	if (pending & (1 << SPI_ERROR))
+		dev->stats.recoverSpi++;
+	if (pending & (1 << RX_ERROR))
+		dev->stats.recoverRx++;
+	if (pending & (1 << TX_HANG_ERROR))
+		dev->stats.recoverTx++;
+	dev->stats.recoverUs = enc28j60PortMicros() - start;
+	if (dev->stats.recoverUs > dev->stats.recoverMaxUs)
+		dev->stats.recoverMaxUs = dev->stats.recoverUs;
+	return 1;
+}
+
+// do a requested recovery, every ETHERNET_RECOVER_BACKOFF ms while the
+// chip doesn't answer
+static void enc28j60RecoverPoll(void)
+{
+	if ((dev->recoverPending & ENC28J60_RECOVER_RETRY)
+	    && enc28j60PortMillis() - dev->recoverTick < ETHERNET_RECOVER_BACKOFF)
+		return;
+	enc28j60Recover();
+}
+
+// Run a requested recovery before the chip is used. Returns 0 while the
+// chip is not set up again (it didn't answer, the next try is later).
+static uint8_t enc28j60RecoverCheck(void)
+{
+	if (dev->recoverPending)
+		enc28j60RecoverPoll();
+	return !dev->recoverPending;
+}
+
+// first byte of the reserved region, ENC28J60_BUFFER_SIZE if there is none
+uint16_t enc28j60ReservedStart(void)
+{
+	return dev->reservedStart;
+}
+
+void enc28j60GetStats(struct enc28j60_stats *out)
+{
+	*out = dev->stats;
+}
+
+void enc28j60ClearStats(void)
+{
+	uint32_t initUs = dev->stats.initUs;
+	uint32_t firstRxUs = dev->stats.firstRxUs;
+
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->stats.initUs = initUs;
+	dev->stats.firstRxUs = firstRxUs;
 }
 
 // read the revision of the chip:
@@ -358,63 +1045,1014 @@ uint8_t enc28j60getrev(void)
 
 // A number of utility functions to enable/disable broadcast and multicast bits
 void enc28j60EnableBroadcast( void ) {
-	erxfcon |= ERXFCON_BCEN;
-	enc28j60Write(ERXFCON, erxfcon);
+	dev->erxfcon |= ERXFCON_BCEN;
+	enc28j60Write(ERXFCON, dev->erxfcon);
 }
 
 void enc28j60DisableBroadcast( void ) {
-	erxfcon &= ~ERXFCON_BCEN;
-	enc28j60Write(ERXFCON, erxfcon);
+	dev->erxfcon &= ~ERXFCON_BCEN;
+	enc28j60Write(ERXFCON, dev->erxfcon);
 }
 
 void enc28j60EnableMulticast( void ) {
-	erxfcon |= ERXFCON_MCEN;
-	enc28j60Write(ERXFCON, erxfcon);
+	dev->erxfcon |= ERXFCON_MCEN;
+	enc28j60Write(ERXFCON, dev->erxfcon);
 }
 
 void enc28j60DisableMulticast( void ) {
-	erxfcon &= ~ERXFCON_MCEN;
-	enc28j60Write(ERXFCON, erxfcon);
+	dev->erxfcon &= ~ERXFCON_MCEN;
+	enc28j60Write(ERXFCON, dev->erxfcon);
+}
+
+// switch the receive filter bits at once, see the ENC28J60_RXFILTER_* profiles
+void enc28j60SetRxFilter(uint8_t flags) {
+	dev->erxfcon = flags;
+	enc28j60Write(ERXFCON, dev->erxfcon);
+}
+
+uint8_t enc28j60GetRxFilter(void) {
+	return dev->erxfcon;
+}
+
+// Multicast hash filter (datasheet 8.3). The pointer into the 64 bit
+// table is bits 28:23 of the ethernet CRC of the destination address.
+uint8_t enc28j60HashIndex(const uint8_t *mac) {
+	uint32_t crc = 0xffffffff;
+	uint8_t i, j;
+
+	for (i = 0; i < 6; i++) {
+		uint8_t b = mac[i];
+		for (j = 0; j < 8; j++) {
+			// bits go in lsb first
+			if (((crc >> 31) ^ b) & 1)
+				crc = (crc << 1) ^ 0x04c11db7;
+			else
+				crc <<= 1;
+			b >>= 1;
+		}
+	}
+	return (crc >> 23) & 0x3f;
+}
+
+// write EHT0..7 and enable the hash filter, disabled if the table is empty
+void enc28j60SetHashTable(const uint8_t *table) {
+	uint8_t used = 0;
+	uint8_t i;
+
+	for (i = 0; i < 8; i++) {
+		enc28j60Write(EHT0 + i, table[i]);
+		dev->hashTable[i] = table[i];
+		used |= table[i];
+	}
+	if (used)
+		dev->erxfcon |= ERXFCON_HTEN;
+	else
+		dev->erxfcon &= ~ERXFCON_HTEN;
+	enc28j60Write(ERXFCON, dev->erxfcon);
+}
+
+// Program the pattern match filter (EPMO, EPMM0..7, EPMCS). The pattern
+// filter is off while the registers are written, so no frame is matched
+// against half of it.
+void enc28j60SetPattern(uint16_t offset, const uint8_t *mask, uint16_t sum) {
+	uint8_t i;
+
+	enc28j60Write(ERXFCON, dev->erxfcon & ~ERXFCON_PMEN);
+	enc28j60WriteWord(EPMOL, offset);
+	for (i = 0; i < 8; i++)
+		enc28j60Write(EPMM0 + i, mask[i]);
+	enc28j60WriteWord(EPMCSL, sum);
+	enc28j60Write(ERXFCON, dev->erxfcon);
+	dev->patternOffset = offset;
+	memcpy(dev->patternMask, mask, sizeof(dev->patternMask));
+	dev->patternSum = sum;
 }
 
 
 // link status
-uint8_t enc28j60linkup(void)
+// read the link state from the PHY and clear LINKIF
+static void enc28j60LinkRefresh(void)
 {
+	// clears LINKIF
+	enc28j60PhyRead(PHIR);
         // bit 10 (= bit 3 in upper reg)
-	return(enc28j60PhyReadH(PHSTAT2) & 4);
+	dev->linkUp = (enc28j60PhyReadH(PHSTAT2) & 4) != 0;
+	dev->linkValid = 1;
+#if ETHERNET_INT_RX
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_LINKIE);
+#endif
 }
 
-void enc28j60PacketSend(uint16_t len, uint8_t* packet)
+// The link state is cached and only read from the PHY after it changed:
+// with ETHERNET_INT_RX the interrupt invalidates the cache, so this is a
+// memory read, otherwise one EIR read checks LINKIF every
+// ETHERNET_LINK_POLL ms and the calls in between return the cached state.
+uint8_t enc28j60linkup(void)
 {
-        // Check no transmit in progress
-  while (enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ECON1) & ECON1_TXRTS)
-  {
-    // Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-    if( (enc28j60Read(EIR) & EIR_TXERIF) ) {
-      enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
-      enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
-    }
-  }
+#if ETHERNET_INT_RX
+	if (!dev->linkValid)
+		enc28j60LinkRefresh();
+#else
+	uint32_t now = enc28j60PortMillis();
+
+	if (dev->linkValid && now - dev->linkTick < ETHERNET_LINK_POLL)
+		return dev->linkUp;
+	dev->linkTick = now;
+	if (!dev->linkValid || (enc28j60ReadOp(ENC28J60_READ_CTRL_REG, EIR) & EIR_LINKIF))
+		enc28j60LinkRefresh();
+#endif
+	return dev->linkUp;
+}
+
+// Switch between half and full duplex. Reception is stopped and the
+// transmit queue drained while MAC and PHY are reconfigured.
+void enc28j60SetDuplex(uint8_t full)
+{
+	uint8_t rxen;
+
+	rxen = enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ECON1) & ECON1_RXEN;
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXEN);
+	while (enc28j60Read(ESTAT) & ESTAT_RXBUSY)
+		enc28j60PortYield();
+	while (enc28j60TxPending())
+		enc28j60PortYield();
+	enc28j60DuplexConfig(full != 0);
+	if (rxen)
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+}
+
+uint8_t enc28j60GetDuplex(void)
+{
+	return dev->fullDuplex;
+}
+
+// Read the duplex setting back from PHY and MAC and compare it with the
+// mode the PHY reports on the link. Returns an ENC28J60_DUPLEX_* code.
+uint8_t enc28j60DuplexCheck(void)
+{
+	uint16_t stat;
+	uint8_t full;
+
+	full = (enc28j60PhyRead(PHCON1) & PHCON1_PDPXMD) != 0;
+	if (full != dev->fullDuplex)
+		return ENC28J60_DUPLEX_PHY;
+	if (((enc28j60Read(MACON3) & MACON3_FULDPX) != 0) != full)
+		return ENC28J60_DUPLEX_MAC;
+	stat = enc28j60PhyRead(PHSTAT2);
+	if (!(stat & PHSTAT2_LSTAT) || ((stat & PHSTAT2_DPXSTAT) != 0) != full)
+		return ENC28J60_DUPLEX_LINK;
+	return ENC28J60_DUPLEX_OK;
+}
+
+// Ask the link partner to hold off: PAUSE frames every ETHERNET_PAUSE_TIME
+// in full duplex, jamming (backpressure) in half duplex. Turning it off
+// in full duplex sends a pause frame with zero time to release it at once.
+void enc28j60FlowControl(uint8_t on)
+{
+	if (dev->fullDuplex)
+		enc28j60Write(EFLOCON, on ? EFLOCON_FCEN1 : EFLOCON_FCEN1|EFLOCON_FCEN0);
+	else
+		enc28j60Write(EFLOCON, on ? EFLOCON_FCEN0 : 0);
+}
+
+#if ETHERNET_INT_RX
+static void enc28j60PushEvent(uint8_t event)
+{
+	uint8_t head = dev->eventHead;
+	uint8_t next = (head + 1) & (ENC28J60_EVENT_RING_SIZE - 1);
+
+	if (next == dev->eventTail) {
+		dev->eventsDropped++;
+		return;
+	}
+	dev->eventRing[head] = event;
+	__DMB();
+	dev->eventHead = next;
+}
+
+// Turn the interrupt flags into events. Runs in the EXTI handler, or at the
+// end of the chip access the interrupt arrived in.
+static void enc28j60ServiceIrq(void)
+{
+	uint8_t bank = dev->bank;
+	uint8_t eir;
+
+	dev->busLock++;
+	dev->irqDeferred = 0;
+	// release the INT pin while the flags are handled, it is asserted again
+	// (with a new edge) if anything enabled is still pending afterwards
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIE, EIE_INTIE);
+	eir = enc28j60ReadOp(ENC28J60_READ_CTRL_REG, EIR);
+	// PKTIF is not reliable, see Rev. B4 Silicon Errata point 6
+	if ((enc28j60Rev()->errata & ENC28J60_ERRATA_PKTIF) ? enc28j60Read(EPKTCNT) : (eir & EIR_PKTIF)) {
+		// no packet interrupts until the main loop drained the buffer
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIE, EIE_PKTIE);
+		if (!dev->rxPending) {
+			dev->rxPending = 1;
+			enc28j60PushEvent(ENC28J60_EVENT_PKT);
+		}
+	}
+	if (eir & EIR_LINKIF) {
+		// LINKIF is cleared by reading PHIR, which is left to the main loop
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIE, EIE_LINKIE);
+		dev->linkValid = 0;
+		enc28j60PushEvent(ENC28J60_EVENT_LINK);
+	}
+	if (eir & EIR_RXERIF) {
+		// the main loop resets the receive buffer
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+		dev->rxOverflow = 1;
+		dev->rxPending = 1;
+		enc28j60PushEvent(ENC28J60_EVENT_RXERR);
+	}
+	// starts the next queued frame right away
+	if (dev->txActive && (eir & (EIR_TXIF|EIR_TXERIF)))
+		enc28j60TxComplete(eir);
+	enc28j60SetBank(bank);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE);
+	dev->busLock--;
+	// another interrupt came in while this one was handled from the main loop
+	if (dev->irqDeferred)
+		enc28j60ServiceIrq();
+}
+#endif
+
+// Call from the EXTI handler of the INT pin (falling edge) of device d
+void enc28j60DevIrqHandler(struct enc28j60_dev *d)
+{
+#if ETHERNET_INT_RX
+	struct enc28j60_dev *prev = dev;
+
+	dev = d;
+#if ETHERNET_SPI_DMA
+	if (dev->dmaBusy)
+		dev->irqDeferred = 1;
+	else
+#endif
+	if (dev->busLock)
+		dev->irqDeferred = 1;
+	else
+		enc28j60ServiceIrq();
+	dev = prev;
+#else
+	(void)d;
+#endif
+}
+
+// the same for enc28j60DefaultDev
+void enc28j60IrqHandler(void)
+{
+	enc28j60DevIrqHandler(&enc28j60DefaultDev);
+}
+
+// Get the next event from the interrupt handler, ENC28J60_EVENT_NONE if
+// there is none. Call from the main loop only.
+uint8_t enc28j60PollEvent(void)
+{
+#if ETHERNET_INT_RX
+	uint8_t tail = dev->eventTail;
+	uint8_t event;
+
+	if (dev->irqDeferred && !dev->busLock)
+		enc28j60ServiceIrq();
+	if (tail == dev->eventHead)
+		return ENC28J60_EVENT_NONE;
+	event = dev->eventRing[tail];
+	__DMB();
+	dev->eventTail = (tail + 1) & (ENC28J60_EVENT_RING_SIZE - 1);
+
+	if (event == ENC28J60_EVENT_LINK)
+		enc28j60linkup();
+	return event;
+#else
+	return ENC28J60_EVENT_NONE;
+#endif
+}
+
+// just probe if there might be a packet, with ETHERNET_INT_RX this costs
+// no SPI traffic
+uint8_t enc28j60hasRxPkt(void)
+{
+#if ETHERNET_INT_RX
+	return dev->rxPending;
+#else
+	return enc28j60Rev()->rxCount(1) > 0;
+#endif
+}
+
+#define TX_SLOT_START(slot) (dev->txStart + (uint16_t)(slot) * dev->txSlotSize)
+
+// rxFrameRead while ERDPT is outside the open frame
+#define ENC28J60_RX_SEEK 0xffff
+
+// start transmission of the oldest queued slot
+static void enc28j60TxKick(void)
+{
+	uint16_t start = TX_SLOT_START(dev->txTail);
+	struct enc28j60_reg kick[] = {
+		ENC28J60_REG_WRITE16(ETXSTL, start),
+		ENC28J60_REG_WRITE16(ETXNDL, start + dev->txLen[dev->txTail]),
+		ENC28J60_REG_CLR(EIR, EIR_TXIF|EIR_TXERIF),
+		ENC28J60_REG_SET(ECON1, ECON1_TXRTS),
+	};
+
+	enc28j60RegBatch(kick, sizeof(kick) / sizeof(kick[0]));
+	dev->txStartTick = enc28j60PortMillis();
+	dev->txActive = 1;
+}
+
+// Decode the 7 byte transmit status vector the chip wrote after the frame
+// on the wire (datasheet table 5-1)
+static void enc28j60TxReadStatus(struct enc28j60_tx_status *st)
+{
+	uint8_t tsv[7];
+
+	enc28j60WriteWord(ERDPTL, TX_SLOT_START(dev->txTail) + dev->txLen[dev->txTail] + 1);
+	enc28j60ReadBuffer(7, tsv);
+	dev->rxFrameRead = ENC28J60_RX_SEEK;
+	st->len = tsv[0] | ((uint16_t)tsv[1] << 8);
+	st->collisions = tsv[2] & 0x0f;
+	st->flags = 0;
+	if (tsv[2] & 0x80)
+		st->flags |= ENC28J60_TXSTAT_DONE;
+	if (tsv[3] & 0x04)
+		st->flags |= ENC28J60_TXSTAT_DEFER;
+	if (tsv[3] & 0x08)
+		st->flags |= ENC28J60_TXSTAT_EXDEFER;
+	if (tsv[3] & 0x10)
+		st->flags |= ENC28J60_TXSTAT_EXCOLL;
+	if (tsv[3] & 0x20)
+		st->flags |= ENC28J60_TXSTAT_LATECOLL;
+	st->wireLen = tsv[4] | ((uint16_t)tsv[5] << 8);
+}
+
+// The frame on the wire is done: report it, free the slot and send the next one
+static void enc28j60TxFinish(struct enc28j60_tx_status *st)
+{
+	st->retries = dev->txRetries;
+	dev->txRetries = 0;
+	if (st->flags & (ENC28J60_TXSTAT_ABORTED|ENC28J60_TXSTAT_TIMEOUT))
+		dev->stats.txErrors++;
+	else
+		dev->stats.txPackets++;
+	if (!(st->flags & ENC28J60_TXSTAT_TIMEOUT))
+		dev->txTimeoutsInRow = 0;
+	dev->stats.txCollisions += st->collisions;
+	dev->txLast = *st;
+	dev->txActive = 0;
+	dev->txTail = (dev->txTail + 1) % dev->txSlots;
+	dev->txCount--;
+#if ETHERNET_INT_RX
+	enc28j60PushEvent(ENC28J60_EVENT_TX);
+#endif
+	if (dev->txCallback)
+		dev->txCallback(st);
+	if (dev->txCount)
+		enc28j60TxKick();
+}
+
+// Free the slot on the wire once TXIF or TXERIF is set and send the next
+// one. A frame lost to a late collision is sent again up to
+// ETHERNET_TX_RETRIES times.
+static void enc28j60TxComplete(uint8_t eir)
+{
+	struct enc28j60_tx_status st;
+
+	if (!dev->txActive || !(eir & (EIR_TXIF|EIR_TXERIF)))
+		return;
+	if (eir & EIR_TXERIF)
+		enc28j60Rev()->txError();
+	enc28j60TxReadStatus(&st);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF|EIR_TXERIF);
+	if (eir & EIR_TXERIF)
+		st.flags |= ENC28J60_TXSTAT_ABORTED;
+	if ((st.flags & ENC28J60_TXSTAT_LATECOLL) && dev->txRetries < ETHERNET_TX_RETRIES) {
+		dev->txRetries++;
+		dev->stats.txRetries++;
+		enc28j60TxKick();
+		return;
+	}
+	enc28j60TxFinish(&st);
+}
+
+// Give up on a frame that did not complete within ETHERNET_TX_TIMEOUT ms
+static void enc28j60TxTimeout(void)
+{
+	struct enc28j60_tx_status st;
+
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+	enc28j60TxReset();
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF|EIR_TXERIF);
+	memset(&st, 0, sizeof(st));
+	st.len = dev->txLen[dev->txTail];
+	st.flags = ENC28J60_TXSTAT_TIMEOUT;
+	dev->stats.txTimeouts++;
+	enc28j60TxFinish(&st);
+	// the transmit reset doesn't get it going again
+	if (++dev->txTimeoutsInRow >= ETHERNET_RECOVER_TX_TIMEOUTS)
+		ENC28j60_Error_Handler(TX_HANG_ERROR);
+}
+
+// Check if the frame on the wire is done and start the next queued one.
+// Called from enc28j60PacketSend and enc28j60PacketReceive, so frames
+// don't wait in the buffer while the main loop is running.
+void enc28j60TxPoll(void)
+{
+	uint8_t eir;
+
+	if (!enc28j60RecoverCheck() || !dev->txActive)
+		return;
+	ENC28J60_LOCK();
+	eir = enc28j60ReadOp(ENC28J60_READ_CTRL_REG, EIR);
+	if (eir & (EIR_TXIF|EIR_TXERIF))
+		enc28j60TxComplete(eir);
+	else if (dev->txActive && enc28j60PortMillis() - dev->txStartTick > ETHERNET_TX_TIMEOUT)
+		enc28j60TxTimeout();
+	ENC28J60_UNLOCK();
+}
+
+// Number of frames queued or on the wire
+uint8_t enc28j60TxPending(void)
+{
+	enc28j60TxPoll();
+	return dev->txCount;
+}
+
+// status of the last frame that left the transmit buffer
+void enc28j60TxLastStatus(struct enc28j60_tx_status *st)
+{
+	*st = dev->txLast;
+}
+
+// Called for every frame that left the transmit buffer, from
+// enc28j60IrqHandler in ETHERNET_INT_RX mode, otherwise from the send,
+// receive and poll functions.
+void enc28j60SetTxCallback(enc28j60_tx_callback callback)
+{
+	dev->txCallback = callback;
+}
 
-	// Set the write pointer to start of transmit buffer area
-	enc28j60WriteWord(EWRPTL, TXSTART_INIT);
-	// Set the TXND pointer to correspond to the packet size given
-	enc28j60WriteWord(ETXNDL, (TXSTART_INIT+len));
+// Wait for a free slot and upload the frame, returns the slot address.
+// Call with the bus locked.
+static uint16_t enc28j60TxUpload(uint16_t len, uint8_t* packet)
+{
+	uint16_t start;
+
+	// wait for a free slot
+	while (dev->txCount == dev->txSlots) {
+		enc28j60TxPoll();
+		enc28j60PortYield();
+	}
+
+	start = TX_SLOT_START(dev->txHead);
+	// Set the write pointer to start of the slot
+	enc28j60WriteWord(EWRPTL, start);
 	// write per-packet control byte (0x00 means use macon3 settings)
 	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
 	// copy the packet into the transmit buffer
 	enc28j60WriteBuffer(len, packet);
-	// send the contents of the transmit buffer onto the network
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
-        // Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
+	dev->txLen[dev->txHead] = len;
+	return start;
+}
+
+// Hand the uploaded slot to the transmitter
+static void enc28j60TxQueue(void)
+{
+	dev->txHead = (dev->txHead + 1) % dev->txSlots;
+	dev->txCount++;
+	// send it now if the transmitter is idle, otherwise it is started
+	// when the frame in front of it completes
+	if (!dev->txActive)
+		enc28j60TxKick();
+}
+
+void enc28j60PacketSend(uint16_t len, uint8_t* packet)
+{
+	// the slot also holds the control byte and the status vector
+	if (!enc28j60RecoverCheck() || len > dev->txSlotSize - 8) {
+		dev->stats.txDropped++;
+		return;
+	}
+	ENC28J60_LOCK();
+	enc28j60TxUpload(len, packet);
+	enc28j60TxQueue();
+	ENC28J60_UNLOCK();
+}
+
+// The CRC and padding after a frame (normally 4-5 bytes) are read through
+// instead of setting ERDPT for the next frame
+#define ENC28J60_RX_SKIP_MAX 8
+
+// address in the receive buffer, wrapped at its end
+static uint16_t enc28j60RxAddr(uint16_t addr)
+{
+	if (addr > dev->rxStop)
+		addr -= dev->rxStop + 1;
+	return addr;
+}
+
+// Run the DMA engine over len bytes at start, as checksum (csum) or as copy
+// to dest. Ranges in the receive buffer wrap at its end.
+static void enc28j60DmaRun(uint16_t start, uint16_t len, uint16_t dest, uint8_t csum)
+{
+	uint16_t end = start + len - 1;
+
+	if (start <= dev->rxStop && end > dev->rxStop)
+		end -= dev->rxStop + 1;
+	enc28j60WriteWord(EDMASTL, start);
+	enc28j60WriteWord(EDMANDL, end);
+	if (!csum)
+		enc28j60WriteWord(EDMADSTL, dest);
+	// CSUMEN is only set for the run of a checksum, together with DMAST
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, csum ? ECON1_CSUMEN|ECON1_DMAST : ECON1_DMAST);
+	while (enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ECON1) & ECON1_DMAST)
+		enc28j60PortYield();
+	if (csum)
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_CSUMEN);
+}
+
+// Checksum of len bytes of the buffer memory at start, calculated by the
+// DMA engine. The result is ready to be put into a header (high byte first),
+// a range that already contains a valid checksum gives 0. Ranges in the
+// receive buffer wrap at its end.
+uint16_t enc28j60DmaChecksum(uint16_t start, uint16_t len)
+{
+	uint16_t ck;
+
+	ENC28J60_LOCK();
+	enc28j60DmaRun(start, len, 0, 1);
+	ck = (uint16_t)enc28j60Read(EDMACSH) << 8;
+	ck |= enc28j60Read(EDMACSL);
+	ENC28J60_UNLOCK();
+	return ck;
+}
+
+// Send a frame and let the chip calculate a checksum over csumLen bytes of
+// it starting at csumStart, the result is written to csumPos (high byte
+// first). The frame is not walked by the MCU. Anything the sum needs that
+// is not in the frame (udp/tcp pseudo header) must be pre-loaded into the
+// checksum field.
+void enc28j60PacketSendCsum(uint16_t len, uint8_t* packet, uint16_t csumStart, uint16_t csumLen, uint16_t csumPos)
+{
+	uint16_t start, ck;
+
+	if (!enc28j60RecoverCheck() || len > dev->txSlotSize - 8) {
+		dev->stats.txDropped++;
+		return;
+	}
+	ENC28J60_LOCK();
+	start = enc28j60TxUpload(len, packet);
+	// +1 for the control byte
+	ck = enc28j60DmaChecksum(start + 1 + csumStart, csumLen);
+	enc28j60WriteWord(EWRPTL, start + 1 + csumPos);
+	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, ck >> 8);
+	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, ck & 0xff);
+	enc28j60TxQueue();
+	ENC28J60_UNLOCK();
+}
+
+// Send hdrlen bytes from hdr followed by len bytes of the open received
+// frame starting at offset. The frame data is copied inside the chip by
+// the DMA engine, only the header goes over SPI. Call before
+// enc28j60RxFinish().
+void enc28j60PacketSendFromRx(uint16_t hdrlen, uint8_t* hdr, uint16_t offset, uint16_t len)
+{
+	uint16_t start;
+
+	// a hot reset throws the received frame away too
+	if (dev->recoverPending) {
+		enc28j60RecoverCheck();
+		dev->stats.txDropped++;
+		return;
+	}
+	if (hdrlen + len > dev->txSlotSize - 8) {
+		dev->stats.txDropped++;
+		return;
+	}
+	ENC28J60_LOCK();
+	start = enc28j60TxUpload(hdrlen, hdr);
+	if (len)
+		enc28j60DmaRun(enc28j60RxAddr(dev->rxFrame + offset), len, start + 1 + hdrlen, 0);
+	dev->txLen[dev->txHead] = hdrlen + len;
+	enc28j60TxQueue();
+	ENC28J60_UNLOCK();
+}
+
+#if ETHERNET_RX_STATS || ETHERNET_RX_BACKPRESSURE
+// bytes used in the receive buffer
+static uint16_t enc28j60RxUsed(void)
+{
+	uint16_t wr;
+
+	wr = enc28j60Read(ERXWRPTL);
+	wr |= (uint16_t)enc28j60Read(ERXWRPTH) << 8;
+	if (wr >= dev->nextPacketPtr)
+		return wr - dev->nextPacketPtr;
+	return wr + dev->rxStop + 1 - dev->nextPacketPtr;
+}
+#endif
+
+// Hold the link partner off while the receive buffer is filling up,
+// release it when it has been drained. used is the fill level in bytes.
+static void enc28j60RxPressure(uint16_t used)
+{
+#if ETHERNET_RX_BACKPRESSURE
+	uint32_t size = (uint32_t)dev->rxStop + 1 - RXSTART_INIT;
+
+	if (!dev->rxPaused && used * 100 > size * ETHERNET_RX_HIGH_WATER) {
+		enc28j60FlowControl(1);
+		dev->rxPaused = 1;
+		dev->stats.rxPauses++;
+	} else if (dev->rxPaused && used * 100 < size * ETHERNET_RX_LOW_WATER) {
+		enc28j60FlowControl(0);
+		dev->rxPaused = 0;
+	}
+#else
+	(void)used;
+#endif
+}
+
+// Throw away everything in the receive buffer and restart reception at
+// its start. MAC, PHY, filters and the transmit side keep their setup, so
+// this is much quicker than enc28j60Init. Used after an overflow, where
+// the backlog is stale anyway, and when the status vector of a frame
+// makes no sense (a corrupted next packet pointer would otherwise send
+// the driver around the ring on garbage).
+static void enc28j60RxReset(void)
+{
+	uint32_t start;
+	uint8_t pktcnt;
+
+	dev->stats.rxResets++;
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXEN);
+	// let a frame that is coming in finish, it takes 1.2 ms at most
+	start = enc28j60PortMillis();
+	while ((enc28j60Read(ESTAT) & ESTAT_RXBUSY) && enc28j60PortMillis() - start < 3)
+		enc28j60PortYield();
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXRST);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_RXRST);
+	pktcnt = enc28j60Read(EPKTCNT);
+	dev->stats.rxDiscarded += pktcnt;
+	while (pktcnt--)
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	// writing ERXST moves the write pointer back to it as well
+	dev->nextPacketPtr = RXSTART_INIT;
+	enc28j60WriteWord(ERXSTL, RXSTART_INIT);
+	enc28j60WriteWord(ERXNDL, dev->rxStop);
+	enc28j60WriteWord(ERXRDPTL, RXSTART_INIT);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+	dev->rxOverflow = 0;
+	enc28j60RxPressure(0);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+	// no good frame since the last resets, the chip needs more than this
+	if (++dev->rxResetsInRow >= ETHERNET_RECOVER_RX_RESETS)
+		ENC28j60_Error_Handler(RX_ERROR);
+}
+
+#if ETHERNET_CSUM_RX_VERIFY
+// Verify the ip header and udp/tcp checksums of the frame at start in the
+// receive buffer with the DMA engine. The first bytes of the frame (hdr of
+// them) are already in buf, len is the full frame length without CRC.
+static uint8_t enc28j60RxChecksumOk(uint16_t start, uint8_t* buf, uint16_t hdr, uint16_t len)
+{
+	uint16_t hlen, iplen, l4len;
+	uint32_t sum;
+
+	// only IPv4 is checked
+	if (hdr < 34 || buf[12] != 0x08 || buf[13] != 0x00)
+		return 1;
+	hlen = (buf[14] & 0x0f) * 4;
+	iplen = ((uint16_t)buf[16] << 8) | buf[17];
+	if (hlen < 20 || iplen < hlen || iplen > len - 14)
+		return 0;
+	// a valid header sums up to 0
+	if (enc28j60DmaChecksum(enc28j60RxAddr(start + 14), hlen) != 0)
+		return 0;
+	// udp and tcp of unfragmented packets
+	if ((buf[23] != 6 && buf[23] != 17) || (buf[20] & 0x3f) || buf[21])
+		return 1;
+	l4len = iplen - hlen;
+	if (l4len < (buf[23] == 6 ? 20 : 8))
+		return 0;
+	// No udp checksum sent. Behind ip options it may not be in buf, the sum
+	// of the field alone is 0 (0xffff complemented) then; ERDPT stays.
+	if (buf[23] == 17) {
+		if (hdr >= 14 + hlen + 8) {
+			if (buf[14 + hlen + 6] == 0 && buf[14 + hlen + 7] == 0)
+				return 1;
+		} else if (enc28j60DmaChecksum(enc28j60RxAddr(start + 14 + hlen + 6), 2) == 0xffff) {
+			return 1;
+		}
+	}
+	// ip.src and ip.dst, the segment after the ip options and the rest of
+	// the pseudo header
+	sum = (uint16_t)~enc28j60DmaChecksum(enc28j60RxAddr(start + 26), 8);
+	sum += (uint16_t)~enc28j60DmaChecksum(enc28j60RxAddr(start + 14 + hlen), l4len);
+	sum += buf[23] + l4len;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum == 0xffff;
+}
+#endif
+
+// Number of frames waiting in the receive buffer, see enc28j60_rev.rxCount
+static uint8_t enc28j60RxCount(uint8_t want)
+{
+	uint8_t pktcnt;
+
+	// the chip is empty after a hot reset
+	if (dev->recoverPending) {
+		enc28j60RecoverCheck();
+		return(0);
+	}
+
+#if !ETHERNET_INT_RX
+	// queued frames are started from the interrupt in ETHERNET_INT_RX mode
+	enc28j60TxPoll();
+#else
+	// a transmission that never completes raises no interrupt
+	if (dev->txActive && enc28j60PortMillis() - dev->txStartTick > ETHERNET_TX_TIMEOUT)
+		enc28j60TxPoll();
+	if (dev->irqDeferred && !dev->busLock)
+		enc28j60ServiceIrq();
+	// nothing signalled by the INT pin, don't touch the bus
+	if (!dev->rxPending)
+		return(0);
+#endif
+	// check if a packet has been received and buffered, by EPKTCNT on
+	// the revisions with the PKTIF errata
+	pktcnt = enc28j60Rev()->rxCount(want);
+	if( pktcnt ==0 ){
+		// nothing stale left to throw away
+		dev->rxOverflow = 0;
+		if (dev->rxPaused)
+			enc28j60RxPressure(0);
+#if ETHERNET_INT_RX
+		// drained: packets arriving from now on raise the interrupt again
+		dev->rxPending = 0;
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_PKTIE);
+#endif
+		return(0);
+  }
+	if (pktcnt > dev->stats.rxPktHighWater)
+		dev->stats.rxPktHighWater = pktcnt;
+#if !ETHERNET_INT_RX
+	// the interrupt handler watches RXERIF in ETHERNET_INT_RX mode
+	if (enc28j60ReadOp(ENC28J60_READ_CTRL_REG, EIR) & EIR_RXERIF)
+		dev->rxOverflow = 1;
+#endif
+	// Frames were lost, what is left is old. Start over instead of working
+	// through a full ring while the next frames are dropped.
+	if (dev->rxOverflow || pktcnt == 255) {
+		dev->stats.rxOverflows++;
+		enc28j60RxReset();
+		return(0);
+	}
+#if ETHERNET_RX_STATS || ETHERNET_RX_BACKPRESSURE
+	{
+		uint16_t used = enc28j60RxUsed();
+
+		if (used > dev->stats.rxBytesHighWater)
+			dev->stats.rxBytesHighWater = used;
+		enc28j60RxPressure(used);
+	}
+#endif
+	return pktcnt;
+}
+
+// longest frame on the wire, with CRC and a VLAN tag
+#define ENC28J60_RX_COUNT_MAX 1522
+
+// Next packet pointer, length and status from the 6 byte receive status
+// vector (see datasheet page 43) of the frame at pos. Returns 0 if the
+// vector can't be right: the next frame must start at the next even
+// address after this one, the length must fit a frame and bit 31 is
+// always zero. The driver state is left alone then.
+static uint8_t enc28j60RxVector(uint16_t pos, uint8_t* vec)
+{
+	uint16_t next = vec[0] | ((uint16_t)vec[1] << 8);
+	uint16_t count = vec[2] | ((uint16_t)vec[3] << 8);
+
+	if (count < 4 || count > ENC28J60_RX_COUNT_MAX || (vec[5] & 0x80)
+	    || next != enc28j60RxAddr(pos + 6 + count + (count & 1))) {
+		dev->stats.rxBadVectors++;
+		return 0;
+	}
+	dev->nextPacketPtr = next;
+	// remove the CRC count
+	dev->rxFrameLen = count - 4;
+	dev->rxFrameStat = vec[4] | ((uint16_t)vec[5] << 8);
+	return 1;
+}
+
+// time to the first frame after init, at least 1 so it counts as taken
+static void enc28j60RxFirst(void)
+{
+	uint32_t us = enc28j60PortMicros() - dev->initStart;
+
+	dev->stats.firstRxUs = us ? us : 1;
+}
+
+// Open the next frame in the receive buffer: read its status vector and
+// leave ERDPT at the first byte of the frame. Returns 0 if there is none.
+static uint8_t enc28j60RxOpen(void)
+{
+	uint8_t vec[6];
+
+	if (enc28j60RxCount(1) == 0)
+		return(0);
+
+	// the frame follows the 6 byte status vector
+	dev->rxFrame = enc28j60RxAddr(dev->nextPacketPtr + 6);
+	// Set the read pointer to the start of the received packet
+	enc28j60WriteWord(ERDPTL, dev->nextPacketPtr);
+	enc28j60ReadBuffer(6, vec);
+	dev->rxFrameRead = 0;
+	if (!enc28j60RxVector(dev->nextPacketPtr, vec)) {
+		enc28j60RxReset();
+		return(0);
+	}
+	if (dev->stats.firstRxUs == 0)
+		enc28j60RxFirst();
+	dev->stats.rxPackets++;
+	dev->rxResetsInRow = 0;
+	return(1);
+}
+
+// Move the RX read pointer to the start of the next received packet.
+// This frees the memory we just read out
+static void enc28j60RxRelease(void)
+{
+	enc28j60WriteWord(ERXRDPTL, enc28j60Rev()->rxReleasePtr());
+}
+
+// Free the open frame in the receive buffer
+void enc28j60RxFinish(void)
+{
+	struct enc28j60_reg finish[] = {
+		ENC28J60_REG_WRITE16(ERXRDPTL, enc28j60Rev()->rxReleasePtr()),
+		// decrement the packet counter indicate we are done with this packet
+		ENC28J60_REG_SET(ECON2, ECON2_PKTDEC),
+	};
+
+	enc28j60RegBatch(finish, sizeof(finish) / sizeof(finish[0]));
+}
+
+// Receive up to count frames in one go: EPKTCNT is read once, every frame
+// is read (status vector, payload and the CRC/padding up to the next
+// frame) in a single chip select, and the ring space is released with one
+// ERXRDPT update at the end. Good frames are stored in packets[] (maxlen
+// bytes each) with their lengths in lens[], bad ones are skipped (with
+// ETHERNET_CSUM_RX_VERIFY also those with a bad ip/udp/tcp checksum).
+// Returns the number of frames stored.
+uint8_t enc28j60PacketReceiveBatch(uint8_t count, uint16_t maxlen, uint8_t** packets, uint16_t* lens)
+{
+	static uint8_t dummy[ENC28J60_RX_SKIP_MAX];
+	uint8_t vec[6];
+	uint8_t n, i, stored = 0;
+	uint16_t len, pos, skip;
+#if ETHERNET_CSUM_RX_VERIFY
+	uint16_t frame;
+#endif
+
+	n = enc28j60RxCount(count);
+	if (n > count)
+		n = count;
+	if (n == 0)
+		return 0;
+
+	enc28j60DmaWait();
+	ENC28J60_LOCK();
+	enc28j60WriteWord(ERDPTL, dev->nextPacketPtr);
+	for (i = 0; i < n; i++) {
+		pos = enc28j60RxAddr(dev->nextPacketPtr + 6);
+#if ETHERNET_CSUM_RX_VERIFY
+		frame = pos;
+#endif
+		enableChip;
+		ENC28J60_SendByte(ENC28J60_READ_BUF_MEM);
+		dev->spi->read(dev, vec, 6);
+		if (!enc28j60RxVector(dev->nextPacketPtr, vec)) {
+			// the frames read so far are fine, the rest goes
+			disableChip;
+			dev->stats.rxPackets += i;
+			while (i--)
+				enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+			enc28j60RxReset();
+			ENC28J60_UNLOCK();
+			return stored;
+		}
+		len = 0;
+		if (dev->rxFrameStat & ENC28J60_RXSTAT_OK) {
+			len = dev->rxFrameLen;
+			if (len > maxlen-1)
+				len = maxlen-1;
+			dev->spi->read(dev, packets[stored], len);
+			lens[stored++] = len;
+		}
+		// bytes left up to the next frame
+		pos = enc28j60RxAddr(pos + len);
+		if (dev->nextPacketPtr >= pos)
+			skip = dev->nextPacketPtr - pos;
+		else
+			skip = dev->nextPacketPtr + dev->rxStop + 1 - pos;
+		if (skip <= ENC28J60_RX_SKIP_MAX) {
+			// CRC and padding, cheaper to clock out than to move ERDPT
+			dev->spi->read(dev, dummy, skip);
+			disableChip;
+		} else {
+			disableChip;
+			enc28j60WriteWord(ERDPTL, dev->nextPacketPtr);
+		}
+#if ETHERNET_CSUM_RX_VERIFY
+		// the DMA engine leaves ERDPT alone, the next frame is read on from there
+		if ((dev->rxFrameStat & ENC28J60_RXSTAT_OK)
+		    && !enc28j60RxChecksumOk(frame, packets[stored - 1], len, dev->rxFrameLen)) {
+			dev->stats.rxCsumErrors++;
+			stored--;
+		}
+#endif
+	}
+	if (dev->stats.firstRxUs == 0)
+		enc28j60RxFirst();
+	dev->stats.rxPackets += n;
+	dev->rxResetsInRow = 0;
+	enc28j60RxRelease();
+	for (i = 0; i < n; i++)
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	ENC28J60_UNLOCK();
+	return stored;
+}
+
+// Open the next received frame and copy its first headlen bytes to head.
+// The frame stays in the receive buffer until enc28j60RxFinish(), so it
+// can be answered in the chip with enc28j60PacketSendFromRx().
+// Returns the frame length (without CRC), 0 if there is none. Frames with
+// CRC or symbol errors are dropped, with ETHERNET_CSUM_RX_VERIFY also
+// those with a bad ip/udp/tcp checksum (the check needs the first 42 bytes
+// in head).
+uint16_t enc28j60RxHead(uint16_t headlen, uint8_t* head)
+{
+	uint16_t len = 0, n;
+
+	// the transmit status is read through ERDPT as well
+	ENC28J60_LOCK();
+	while (enc28j60RxOpen()) {
+		if (dev->rxFrameStat & ENC28J60_RXSTAT_OK) {
+			n = headlen < dev->rxFrameLen ? headlen : dev->rxFrameLen;
+			enc28j60ReadBuffer(n, head);
+			dev->rxFrameRead = n;
+#if ETHERNET_CSUM_RX_VERIFY
+			if (!enc28j60RxChecksumOk(dev->rxFrame, head, n, dev->rxFrameLen)) {
+				dev->stats.rxCsumErrors++;
+				enc28j60RxFinish();
+				continue;
+			}
+#endif
+			len = dev->rxFrameLen;
+			break;
+		}
+		enc28j60RxFinish();
+	}
+	ENC28J60_UNLOCK();
+	return len;
+}
+
+// ENC28J60_RXSTAT_* bits of the open frame
+uint16_t enc28j60RxStatus(void)
+{
+	return dev->rxFrameStat;
 }
 
-// just probe if there might be a packet
-//uint8_t enc28j60hasRxPkt(void)
-//{
-//       return enc28j60ReadByte(EPKTCNT) > 0;
-//}
+// Copy len bytes at offset of the open frame to data. The frame can be
+// read in any order, the read pointer wraps at the end of the ring. Reading
+// on where the last read stopped needs no new ERDPT.
+void enc28j60RxRead(uint16_t offset, uint16_t len, uint8_t* data)
+{
+	if (offset >= dev->rxFrameLen)
+		return;
+	if (len > dev->rxFrameLen - offset)
+		len = dev->rxFrameLen - offset;
+	ENC28J60_LOCK();
+	if (dev->rxFrameRead != offset)
+		enc28j60WriteWord(ERDPTL, enc28j60RxAddr(dev->rxFrame + offset));
+	enc28j60ReadBuffer(len, data);
+	dev->rxFrameRead = offset + len;
+	ENC28J60_UNLOCK();
+}
+
+// Copy the open frame after the first headlen bytes to packet+headlen.
+// Returns the packet length like enc28j60PacketReceive.
+uint16_t enc28j60RxRest(uint16_t headlen, uint16_t maxlen, uint8_t* packet)
+{
+	uint16_t len = dev->rxFrameLen;
+
+	if (len > maxlen-1)
+		len = maxlen-1;
+	if (len > headlen)
+		enc28j60RxRead(headlen, len - headlen, packet + headlen);
+	return len;
+}
 
 // Gets a packet from the network receive buffer, if one is available.
 // The packet will by headed by an ethernet header.
@@ -423,32 +2061,18 @@ void enc28j60PacketSend(uint16_t len, uint8_t* packet)
 // Returns: Packet length in bytes if a packet was retrieved, zero otherwise.
 uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
 {
-  uint16_t rxstat;
 	uint16_t len;
-	// check if a packet has been received and buffered
-	//if( !(enc28j60Read(EIR) & EIR_PKTIF) ){
-        // The above does not work. See Rev. B4 Silicon Errata point 6.
-	if( enc28j60Read(EPKTCNT) ==0 ){
-		return(0);
-  }
+#if ETHERNET_CSUM_RX_VERIFY
+	uint16_t hdr;
+#endif
 
-	// Set the read pointer to the start of the received packet
-	enc28j60WriteWord(ERDPTL, gNextPacketPtr);
-	//enc28j60Write(ERDPTL, (gNextPacketPtr &0xFF));
-	//enc28j60Write(ERDPTH, (gNextPacketPtr)>>8);
-	// read the next packet pointer
-	gNextPacketPtr  = enc28j60ReadBufferWord();
-	//gNextPacketPtr  = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	//gNextPacketPtr |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
-	// read the packet length (see datasheet page 43)
-	len = enc28j60ReadBufferWord() - 4;
-	//len = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	//len |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
-        //len-=4; //remove the CRC count
-	// read the receive status (see datasheet page 43)
-	rxstat  = enc28j60ReadBufferWord();
-	//rxstat  = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	//rxstat |= ((uint16_t)enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0))<<8;
+	// the transmit status is read through ERDPT as well
+	ENC28J60_LOCK();
+	if (!enc28j60RxOpen()) {
+		ENC28J60_UNLOCK();
+		return(0);
+	}
+	len = dev->rxFrameLen;
 	// limit retrieve length
   if (len>maxlen-1){
     len=maxlen-1;
@@ -456,31 +2080,28 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
   // check CRC and symbol errors (see datasheet page 44, table 7-3):
   // The ERXFCON.CRCEN is set by default. Normally we should not
   // need to check this.
-  if ((rxstat & 0x80)==0){
+  if ((dev->rxFrameStat & ENC28J60_RXSTAT_OK)==0){
     // invalid
     len=0;
   }else{
+#if ETHERNET_CSUM_RX_VERIFY
+    // read the headers, check the checksums in the chip and only copy
+    // the rest of a good frame
+    hdr = len < 42 ? len : 42;
+    enc28j60ReadBuffer(hdr, packet);
+    if (!enc28j60RxChecksumOk(dev->rxFrame, packet, hdr, dev->rxFrameLen)) {
+      dev->stats.rxCsumErrors++;
+      len=0;
+    } else if (len > hdr) {
+      enc28j60ReadBuffer(len - hdr, packet + hdr);
+    }
+#else
     // copy the packet from the receive buffer
     enc28j60ReadBuffer(len, packet);
+#endif
   }
-	// Move the RX read pointer to the start of the next received packet
-	// This frees the memory we just read out
-	enc28j60WriteWord(ERXRDPTL, gNextPacketPtr );
-	//enc28j60Write(ERXRDPTL, (gNextPacketPtr &0xFF));
-	//enc28j60Write(ERXRDPTH, (gNextPacketPtr)>>8);
-  // However, compensate for the errata point 13, rev B4: enver write an even address!
-  if ((gNextPacketPtr - 1 < RXSTART_INIT)
-          || (gNextPacketPtr -1 > RXSTOP_INIT)) {
-    enc28j60WriteWord(ERXRDPTL, RXSTOP_INIT);
-    //enc28j60Write(ERXRDPTL, (RXSTOP_INIT)&0xFF);
-    //enc28j60Write(ERXRDPTH, (RXSTOP_INIT)>>8);
-  } else {
-    enc28j60WriteWord(ERXRDPTL, (gNextPacketPtr-1));
-    //enc28j60Write(ERXRDPTL, (gNextPacketPtr-1)&0xFF);
-    //enc28j60Write(ERXRDPTH, (gNextPacketPtr-1)>>8);
-  }
-	// decrement the packet counter indicate we are done with this packet
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	enc28j60RxFinish();
+	ENC28J60_UNLOCK();
 	return(len);
 
 /*
@@ -494,9 +2115,9 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
         }
 
 	// Set the read pointer to the start of the received packet
-	enc28j60WriteWord(ERDPTL, gNextPacketPtr);
+	enc28j60WriteWord(ERDPTL, dev->nextPacketPtr);
 	// read the next packet pointer
-	gNextPacketPtr  = enc28j60ReadBufferWord();
+	dev->nextPacketPtr  = enc28j60ReadBufferWord();
 	// read the packet length (see datasheet page 43)
 	len  = enc28j60ReadBufferWord() - 4;
 	// read the receive status (see datasheet page 43)
@@ -519,11 +2140,11 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t* packet)
 	// This frees the memory we just read out
 //	enc28j60WriteWord(ERXRDPTL, gNextPacketPtr );
         // However, compensate for the errata point 13, rev B4: enver write an even address!
-        if ((gNextPacketPtr - 1 < RXSTART_INIT)
-                || (gNextPacketPtr -1 > RXSTOP_INIT)) {
+        if ((dev->nextPacketPtr - 1 < RXSTART_INIT)
+                || (dev->nextPacketPtr -1 > RXSTOP_INIT)) {
                 enc28j60WriteWord(ERXRDPTL, RXSTOP_INIT);
         } else {
-                enc28j60WriteWord(ERXRDPTL, (gNextPacketPtr-1));
+                enc28j60WriteWord(ERXRDPTL, (dev->nextPacketPtr-1));
         }
 	// decrement the packet counter indicate we are done with this packet
 	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
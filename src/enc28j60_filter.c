@@ -0,0 +1,134 @@
+#include <string.h>
+#include "enc28j60.h"
+#include "enc28j60_filter.h"
+#include "net.h"
+
+void enc28j60FilterInit(struct enc28j60_filter *f)
+{
+	f->count = 0;
+}
+
+// insert one byte keeping pos ascending
+static uint8_t enc28j60FilterByte(struct enc28j60_filter *f, uint16_t pos, uint8_t value)
+{
+	uint8_t i = f->count;
+
+	while (i > 0 && f->pos[i - 1] > pos)
+		i--;
+	if (i > 0 && f->pos[i - 1] == pos)
+		return f->value[i - 1] == value;
+	if (f->count >= ENC28J60_FILTER_WINDOW)
+		return 0;
+	memmove(&f->pos[i + 1], &f->pos[i], (f->count - i) * sizeof(f->pos[0]));
+	memmove(&f->value[i + 1], &f->value[i], f->count - i);
+	f->pos[i] = pos;
+	f->value[i] = value;
+	f->count++;
+	return 1;
+}
+
+uint8_t enc28j60FilterMatch(struct enc28j60_filter *f, uint16_t pos, const uint8_t *bytes, uint8_t len)
+{
+	while (len--) {
+		if (!enc28j60FilterByte(f, pos++, *bytes++))
+			return 0;
+	}
+	return 1;
+}
+
+static uint8_t enc28j60FilterWord(struct enc28j60_filter *f, uint16_t pos, uint16_t value)
+{
+	uint8_t bytes[2] = { value >> 8, value & 0xff };
+
+	return enc28j60FilterMatch(f, pos, bytes, 2);
+}
+
+uint8_t enc28j60FilterEtherType(struct enc28j60_filter *f, uint16_t type)
+{
+	return enc28j60FilterWord(f, ETH_TYPE_H_P, type);
+}
+
+uint8_t enc28j60FilterIpProto(struct enc28j60_filter *f, uint8_t proto)
+{
+	return enc28j60FilterEtherType(f, (ETHTYPE_IP_H_V << 8) | ETHTYPE_IP_L_V)
+	    && enc28j60FilterMatch(f, IP_PROTO_P, &proto, 1);
+}
+
+// only whole bytes can be compared, a prefix is rounded down
+static uint8_t enc28j60FilterIp(struct enc28j60_filter *f, uint16_t pos, const uint8_t *ip, uint8_t prefix)
+{
+	if (prefix > 32)
+		prefix = 32;
+	return enc28j60FilterEtherType(f, (ETHTYPE_IP_H_V << 8) | ETHTYPE_IP_L_V)
+	    && enc28j60FilterMatch(f, pos, ip, prefix / 8);
+}
+
+uint8_t enc28j60FilterIpSrc(struct enc28j60_filter *f, const uint8_t *ip, uint8_t prefix)
+{
+	return enc28j60FilterIp(f, IP_SRC_P, ip, prefix);
+}
+
+uint8_t enc28j60FilterIpDst(struct enc28j60_filter *f, const uint8_t *ip, uint8_t prefix)
+{
+	return enc28j60FilterIp(f, IP_DST_P, ip, prefix);
+}
+
+// the port offsets are only valid for a 20 byte IP header
+static uint8_t enc28j60FilterPort(struct enc28j60_filter *f, uint8_t proto, uint16_t pos, uint16_t port)
+{
+	uint8_t verlen = IP_V4_V | IP_HEADER_LENGTH_V;
+
+	return enc28j60FilterIpProto(f, proto)
+	    && enc28j60FilterMatch(f, IP_HEADER_LEN_VER_P, &verlen, 1)
+	    && enc28j60FilterWord(f, pos, port);
+}
+
+uint8_t enc28j60FilterUdpSrcPort(struct enc28j60_filter *f, uint16_t port)
+{
+	return enc28j60FilterPort(f, IP_PROTO_UDP_V, UDP_SRC_PORT_H_P, port);
+}
+
+uint8_t enc28j60FilterUdpDstPort(struct enc28j60_filter *f, uint16_t port)
+{
+	return enc28j60FilterPort(f, IP_PROTO_UDP_V, UDP_DST_PORT_H_P, port);
+}
+
+uint8_t enc28j60FilterTcpDstPort(struct enc28j60_filter *f, uint16_t port)
+{
+	return enc28j60FilterPort(f, IP_PROTO_TCP_V, TCP_DST_PORT_H_P, port);
+}
+
+uint8_t enc28j60FilterApply(const struct enc28j60_filter *f)
+{
+	uint8_t mask[ENC28J60_FILTER_WINDOW / 8];
+	uint16_t offset;
+	uint32_t sum = 0;
+	uint8_t i;
+
+	if (f->count == 0)
+		return ENC28J60_FILTER_EMPTY;
+	if (f->pos[f->count - 1] - f->pos[0] >= ENC28J60_FILTER_WINDOW)
+		return ENC28J60_FILTER_SPAN;
+
+	// A frame shorter than the end of the window never matches, so
+	// start the window as early as possible rather than at the first
+	// compared byte.
+	offset = f->pos[f->count - 1] >= ENC28J60_FILTER_WINDOW ?
+		f->pos[f->count - 1] - (ENC28J60_FILTER_WINDOW - 1) : 0;
+
+	// The chip sums the selected bytes as if they were consecutive,
+	// high byte first, and compares the one's complement.
+	memset(mask, 0, sizeof(mask));
+	for (i = 0; i < f->count; i++) {
+		uint8_t bit = f->pos[i] - offset;
+
+		mask[bit / 8] |= 1 << (bit % 8);
+		sum += (i & 1) ? f->value[i] : (uint16_t)f->value[i] << 8;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~sum & 0xffff;
+
+	enc28j60SetPattern(offset, mask, sum);
+	return ENC28J60_FILTER_OK;
+}
@@ -0,0 +1,50 @@
+#include "enc28j60.h"
+
+#if ETHERNET_PORT == ENC28J60_PORT_FREERTOS
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// FreeRTOS on STM32, the kernel tick on SysTick (the HAL timebase is then
+// usually moved to a timer). Call the library from tasks only; before the
+// scheduler runs the delays fall back to HAL_Delay.
+// Needs INCLUDE_vTaskDelay and INCLUDE_xTaskGetSchedulerState.
+
+#define ENC28J60_US_PER_TICK (1000000UL / configTICK_RATE_HZ)
+
+uint32_t enc28j60PortMicros(void)
+{
+	TickType_t ticks;
+	uint32_t val, load = SysTick->LOAD + 1;
+
+	do {
+		ticks = xTaskGetTickCount();
+		val = SysTick->VAL;
+	} while (ticks != xTaskGetTickCount());
+	return (uint32_t)ticks * ENC28J60_US_PER_TICK + (load - val) * ENC28J60_US_PER_TICK / load;
+}
+
+uint32_t enc28j60PortMillis(void)
+{
+	return (uint32_t)((uint64_t)xTaskGetTickCount() * 1000 / configTICK_RATE_HZ);
+}
+
+void enc28j60PortDelayMs(uint32_t ms)
+{
+	if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+		HAL_Delay(ms);
+		return;
+	}
+	// at least one tick, rounded up
+	vTaskDelay((ms * configTICK_RATE_HZ + 999) / 1000);
+}
+
+// Let the tasks of the same priority run. Lower priority tasks only get
+// the CPU when the waits are made with enc28j60PortDelayMs.
+void enc28j60PortYield(void)
+{
+	if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+		taskYIELD();
+}
+
+#endif /* ETHERNET_PORT == ENC28J60_PORT_FREERTOS */
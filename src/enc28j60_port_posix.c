@@ -0,0 +1,45 @@
+#include "enc28j60.h"
+
+#if ETHERNET_PORT == ENC28J60_PORT_POSIX
+
+#include <sched.h>
+#include <time.h>
+
+// Linux host: CLOCK_MONOTONIC relative to the first call, so the
+// milliseconds start near zero like the HAL tick.
+static uint64_t enc28j60PosixUs(void)
+{
+	static uint64_t start;
+	struct timespec ts;
+	uint64_t us;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (start == 0)
+		start = us;
+	return us - start;
+}
+
+uint32_t enc28j60PortMicros(void)
+{
+	return (uint32_t)enc28j60PosixUs();
+}
+
+uint32_t enc28j60PortMillis(void)
+{
+	return (uint32_t)(enc28j60PosixUs() / 1000);
+}
+
+void enc28j60PortDelayMs(uint32_t ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+	while (nanosleep(&ts, &ts) != 0);
+}
+
+void enc28j60PortYield(void)
+{
+	sched_yield();
+}
+
+#endif /* ETHERNET_PORT == ENC28J60_PORT_POSIX */
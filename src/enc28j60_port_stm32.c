@@ -0,0 +1,34 @@
+#include "enc28j60.h"
+
+#if ETHERNET_PORT == ENC28J60_PORT_STM32
+
+// Bare metal STM32 with the HAL tick (1 kHz) on SysTick. The microseconds
+// are the HAL tick plus the part of the current millisecond SysTick has
+// counted down; the tick is read again to catch a wrap in between.
+uint32_t enc28j60PortMicros(void)
+{
+	uint32_t ms, val, load = SysTick->LOAD + 1;
+
+	do {
+		ms = HAL_GetTick();
+		val = SysTick->VAL;
+	} while (ms != HAL_GetTick());
+	return ms * 1000 + (load - val) * 1000 / load;
+}
+
+uint32_t enc28j60PortMillis(void)
+{
+	return HAL_GetTick();
+}
+
+void enc28j60PortDelayMs(uint32_t ms)
+{
+	HAL_Delay(ms);
+}
+
+// nothing else to run
+void enc28j60PortYield(void)
+{
+}
+
+#endif /* ETHERNET_PORT == ENC28J60_PORT_STM32 */
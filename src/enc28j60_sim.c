@@ -0,0 +1,691 @@
+#include <string.h>
+#include "enc28j60.h"
+#include "enc28j60_sim.h"
+
+#define SIM_MEM_MASK (ENC28J60_SIM_MEM_SIZE - 1)
+
+// SPI command state: waiting for the opcode, or nothing more to do
+#define SIM_CMD_OPCODE 0xFF
+#define SIM_CMD_DONE   0xFE
+// opcodes (top 3 bits of the first byte)
+#define SIM_OP_RCR 0
+#define SIM_OP_RBM 1
+#define SIM_OP_WCR 2
+#define SIM_OP_WBM 3
+#define SIM_OP_BFS 4
+#define SIM_OP_BFC 5
+
+// register access by the enc28j60.h names, common registers in bank 0
+static uint8_t *enc28j60SimReg(struct enc28j60_sim *sim, uint8_t bank, uint8_t addr)
+{
+	if (addr >= (EIE & ADDR_MASK))
+		return &sim->reg[0][addr];
+	return &sim->reg[bank][addr];
+}
+
+#define REG(r) (*enc28j60SimReg(sim, ((r) & BANK_MASK) >> 5, (r) & ADDR_MASK))
+
+static uint16_t enc28j60SimWord(struct enc28j60_sim *sim, uint8_t r)
+{
+	return REG(r) | ((uint16_t)REG(r + 1) << 8);
+}
+
+static void enc28j60SimSetWord(struct enc28j60_sim *sim, uint8_t r, uint16_t v)
+{
+	REG(r) = v & 0xff;
+	REG(r + 1) = v >> 8;
+}
+
+// MAC and MII registers answer a read with a dummy byte first
+static uint8_t enc28j60SimIsMac(uint8_t bank, uint8_t addr)
+{
+	if (addr >= (EIE & ADDR_MASK))
+		return 0;
+	if (bank == 2)
+		return 1;
+	return bank == 3 && (addr <= (MAADR4 & ADDR_MASK) || addr == (MISTAT & ADDR_MASK));
+}
+
+// next address in the buffer memory, wrapping at the end of the receive ring
+static uint16_t enc28j60SimNext(struct enc28j60_sim *sim, uint16_t a)
+{
+	if (a == enc28j60SimWord(sim, ERXNDL))
+		return enc28j60SimWord(sim, ERXSTL);
+	return (a + 1) & SIM_MEM_MASK;
+}
+
+// the released revisions up to B7 have the errata, see enc28j60_sim.h
+static uint8_t enc28j60SimErrata(struct enc28j60_sim *sim)
+{
+	return sim->revision <= ENC28J60_SIM_REV_B7;
+}
+
+static uint8_t enc28j60SimPktif(struct enc28j60_sim *sim)
+{
+	if (enc28j60SimErrata(sim))
+		return sim->pktif;
+	return REG(EPKTCNT) != 0;
+}
+
+// registers after a system reset, the PHY keeps its state
+static void enc28j60SimReset(struct enc28j60_sim *sim)
+{
+	memset(sim->reg, 0, sizeof(sim->reg));
+	enc28j60SimSetWord(sim, ERDPTL, 0x05FA);
+	enc28j60SimSetWord(sim, ERXSTL, 0x05FA);
+	enc28j60SimSetWord(sim, ERXNDL, 0x1FFF);
+	enc28j60SimSetWord(sim, ERXRDPTL, 0x05FA);
+	enc28j60SimSetWord(sim, ERXWRPTL, 0x05FA);
+	REG(ESTAT) = ESTAT_CLKRDY;
+	REG(ECON2) = ECON2_AUTOINC;
+	REG(ERXFCON) = ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN;
+	REG(MACLCON1) = 0x0F;
+	REG(MACLCON2) = 0x37;
+	enc28j60SimSetWord(sim, MAMXFLL, 0x0600);
+	REG(EREVID) = sim->revision;
+	REG(ECOCON) = 0x04;
+	enc28j60SimSetWord(sim, EPAUSL, 0x1000);
+	sim->rdptCorrupt = 0;
+	sim->pktif = 0;
+	sim->txStalled = 0;
+	sim->txHang = 0;
+	sim->clkWait = 0;
+}
+
+static void enc28j60SimPhyReset(struct enc28j60_sim *sim)
+{
+	memset(sim->phy, 0, sizeof(sim->phy));
+	sim->phy[PHHID1] = 0x0083;
+	sim->phy[PHHID2] = 0x1400;
+	sim->phy[PHLCON] = 0x3422;
+}
+
+void enc28j60SimPowerCycle(struct enc28j60_sim *sim)
+{
+	sim->cmd = SIM_CMD_DONE;
+	enc28j60SimPhyReset(sim);
+	enc28j60SimReset(sim);
+}
+
+void enc28j60SimInit(struct enc28j60_sim *sim)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->revision = ENC28J60_SIM_REV_DEFAULT;
+	sim->linkUp = 1;
+	sim->cmd = SIM_CMD_DONE;
+	enc28j60SimPhyReset(sim);
+	enc28j60SimReset(sim);
+}
+
+// PHIR.PGIF and EIR.LINKIF follow PLNKIF if the interrupt is enabled
+static void enc28j60SimPhyIrq(struct enc28j60_sim *sim)
+{
+	if ((sim->phy[PHIR] & PHIR_PLNKIF) && (sim->phy[PHIE] & PHIE_PLNKIE)
+	    && (sim->phy[PHIE] & PHIE_PGEIE)) {
+		sim->phy[PHIR] |= PHIR_PGIF;
+		REG(EIR) |= EIR_LINKIF;
+	} else {
+		sim->phy[PHIR] &= ~PHIR_PGIF;
+		REG(EIR) &= ~EIR_LINKIF;
+	}
+}
+
+void enc28j60SimSetLink(struct enc28j60_sim *sim, uint8_t up)
+{
+	if (sim->linkUp == up)
+		return;
+	sim->linkUp = up;
+	sim->phy[PHIR] |= PHIR_PLNKIF;
+	enc28j60SimPhyIrq(sim);
+}
+
+static uint16_t enc28j60SimPhyRead(struct enc28j60_sim *sim, uint8_t addr)
+{
+	uint16_t v;
+
+	addr &= 0x1F;
+	switch (addr) {
+	case PHSTAT1:
+		return PHSTAT1_PFDPX|PHSTAT1_PHDPX | (sim->linkUp ? PHSTAT1_LLSTAT : 0);
+	case PHSTAT2:
+		return (sim->linkUp ? PHSTAT2_LSTAT : 0)
+		    | ((sim->phy[PHCON1] & PHCON1_PDPXMD) ? PHSTAT2_DPXSTAT : 0);
+	case PHIR:
+		// reading clears the flags
+		v = sim->phy[PHIR];
+		sim->phy[PHIR] = 0;
+		enc28j60SimPhyIrq(sim);
+		return v;
+	default:
+		return sim->phy[addr];
+	}
+}
+
+static void enc28j60SimPhyWrite(struct enc28j60_sim *sim, uint8_t addr, uint16_t v)
+{
+	addr &= 0x1F;
+	switch (addr) {
+	case PHCON1:
+		if (v & PHCON1_PRST) {
+			enc28j60SimPhyReset(sim);
+			return;
+		}
+		/* fall through */
+	case PHCON2:
+	case PHLCON:
+		sim->phy[addr] = v;
+		break;
+	case PHIE:
+		sim->phy[addr] = v;
+		enc28j60SimPhyIrq(sim);
+		break;
+	}
+}
+
+static uint16_t enc28j60SimChecksum(struct enc28j60_sim *sim, uint16_t a, uint16_t end)
+{
+	uint32_t sum = 0;
+	uint16_t n;
+
+	for (n = 0; n < ENC28J60_SIM_MEM_SIZE; n++) {
+		sum += (n & 1) ? sim->mem[a] : (uint16_t)sim->mem[a] << 8;
+		if (a == end)
+			break;
+		a = enc28j60SimNext(sim, a);
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum & 0xffff;
+}
+
+// DMA copy or checksum from EDMAST to EDMAND, both wrap in the receive ring
+static void enc28j60SimDma(struct enc28j60_sim *sim)
+{
+	uint16_t a = enc28j60SimWord(sim, EDMASTL);
+	uint16_t end = enc28j60SimWord(sim, EDMANDL);
+	uint16_t d = enc28j60SimWord(sim, EDMADSTL);
+	uint16_t n;
+
+	if (REG(ECON1) & ECON1_CSUMEN) {
+		n = enc28j60SimChecksum(sim, a, end);
+		REG(EDMACSH) = n >> 8;
+		REG(EDMACSL) = n & 0xff;
+		sim->stats.dmaChecksums++;
+	} else {
+		for (n = 0; n < ENC28J60_SIM_MEM_SIZE; n++) {
+			sim->mem[d] = sim->mem[a];
+			if (a == end)
+				break;
+			a = enc28j60SimNext(sim, a);
+			d = enc28j60SimNext(sim, d);
+		}
+		sim->stats.dmaCopies++;
+	}
+	REG(ECON1) &= ~ECON1_DMAST;
+	REG(EIR) |= EIR_DMAIF;
+}
+
+// Send ETXST+1..ETXND, the control byte at ETXST, and write the status
+// vector after it
+static void enc28j60SimTransmit(struct enc28j60_sim *sim)
+{
+	static uint8_t frame[ENC28J60_SIM_MEM_SIZE];
+	uint16_t start = enc28j60SimWord(sim, ETXSTL);
+	uint16_t end = enc28j60SimWord(sim, ETXNDL);
+	uint8_t ctrl = sim->mem[start];
+	uint8_t pad, crc;
+	uint16_t len, wire, i, a;
+	uint8_t tsv[7];
+
+	REG(ECON1) &= ~ECON1_TXRTS;
+	REG(ESTAT) &= ~ESTAT_TXABRT;
+	if (end <= start || sim->txAbort) {
+		sim->txAbort = 0;
+		REG(EIR) |= EIR_TXERIF;
+		REG(ESTAT) |= ESTAT_TXABRT;
+		sim->txStalled = enc28j60SimErrata(sim);
+		return;
+	}
+	if (ctrl & 0x01) {
+		// per packet override
+		pad = ctrl & 0x04;
+		crc = ctrl & 0x02;
+	} else {
+		pad = REG(MACON3) & (MACON3_PADCFG2|MACON3_PADCFG1|MACON3_PADCFG0);
+		crc = REG(MACON3) & MACON3_TXCRCEN;
+	}
+	len = end - start;
+	for (i = 0, a = start + 1; i < len; i++, a = (a + 1) & SIM_MEM_MASK)
+		frame[i] = sim->mem[a];
+	if (pad && len < 60) {
+		memset(frame + len, 0, 60 - len);
+		len = 60;
+	}
+	wire = len + (crc ? 4 : 0);
+
+	memset(tsv, 0, sizeof(tsv));
+	tsv[0] = wire & 0xff;
+	tsv[1] = wire >> 8;
+	tsv[2] = 0x80;  // done
+	if (memcmp(frame, "\xff\xff\xff\xff\xff\xff", 6) == 0)
+		tsv[3] |= 0x02;
+	else if (frame[0] & 1)
+		tsv[3] |= 0x01;
+	tsv[4] = wire & 0xff;
+	tsv[5] = wire >> 8;
+	for (i = 0, a = (end + 1) & SIM_MEM_MASK; i < sizeof(tsv); i++, a = (a + 1) & SIM_MEM_MASK)
+		sim->mem[a] = tsv[i];
+
+	sim->stats.txFrames++;
+	if (sim->txHook)
+		sim->txHook(sim, frame, len);
+	REG(EIR) |= EIR_TXIF;
+}
+
+// control register write, op is WCR, BFS or BFC
+static void enc28j60SimRegWrite(struct enc28j60_sim *sim, uint8_t op, uint8_t bank, uint8_t addr, uint8_t data)
+{
+	uint8_t *r = enc28j60SimReg(sim, bank, addr);
+	uint8_t old = *r;
+	uint8_t v, mask = 0xff;
+	uint8_t reg = addr >= (EIE & ADDR_MASK) ? addr : (bank << 5) | addr;
+
+	// bit field operations only work on the ETH registers
+	if (op != SIM_OP_WCR && enc28j60SimIsMac(bank, addr))
+		return;
+	if (op == SIM_OP_BFS)
+		v = old | data;
+	else if (op == SIM_OP_BFC)
+		v = old & ~data;
+	else
+		v = data;
+
+	switch (reg) {
+	case EIR:
+		mask = EIR_DMAIF|EIR_TXIF|EIR_TXERIF|EIR_RXERIF;
+		break;
+	case ESTAT:
+		mask = 0x40|ESTAT_LATECOL|ESTAT_TXABRT;
+		break;
+	case ERXWRPTL: case ERXWRPTH:
+	case EDMACSL: case EDMACSH:
+	case EPKTCNT:
+	case EREVID:
+		return;
+	}
+	if (enc28j60SimIsMac(bank, addr)) {
+		if (reg == (MISTAT & ~SPRD_MASK) || reg == (MIRDL & ~SPRD_MASK) || reg == (MIRDH & ~SPRD_MASK))
+			return;
+	}
+	*r = (old & ~mask) | (v & mask);
+
+	switch (reg) {
+	case ECON1:
+		// bit operations on the bank select bits only, or a write changing them
+		if (op == SIM_OP_WCR ? (old ^ *r) & (ECON1_BSEL1|ECON1_BSEL0) : !(data & ~(ECON1_BSEL1|ECON1_BSEL0)))
+			sim->stats.bankSelects++;
+		if (*r & ECON1_DMAST)
+			enc28j60SimDma(sim);
+		if (*r & ECON1_TXRST)
+			sim->txStalled = 0;
+		if ((*r & ECON1_TXRTS) && !(*r & ECON1_TXRST)) {
+			if (!sim->txStalled && !sim->txHang)
+				enc28j60SimTransmit(sim);
+			else if (!(old & ECON1_TXRTS))
+				sim->stats.txStalls++;
+		}
+		break;
+	case ECON2:
+		if (*r & ECON2_PKTDEC) {
+			*r &= ~ECON2_PKTDEC;
+			if (REG(EPKTCNT))
+				REG(EPKTCNT)--;
+			sim->pktif = 0;
+		}
+		break;
+	case EFLOCON:
+		if ((*r & (EFLOCON_FCEN1|EFLOCON_FCEN0)) && !(old & (EFLOCON_FCEN1|EFLOCON_FCEN0)))
+			sim->stats.flowControl++;
+		break;
+	case ERXSTL: case ERXSTH:
+		// the write pointer follows the start of the receive buffer
+		enc28j60SimSetWord(sim, ERXWRPTL, enc28j60SimWord(sim, ERXSTL));
+		break;
+	case ERXRDPTH: {
+		uint16_t rd = enc28j60SimWord(sim, ERXRDPTL);
+
+		if (!(rd & 1) && rd != enc28j60SimWord(sim, ERXSTL)) {
+			sim->stats.rdptEven++;
+			sim->rdptCorrupt = enc28j60SimErrata(sim);
+		} else {
+			sim->rdptCorrupt = 0;
+		}
+		break;
+	}
+	case MICMD & ~SPRD_MASK:
+		if ((*r & MICMD_MIIRD) && !(old & MICMD_MIIRD)) {
+			enc28j60SimSetWord(sim, MIRDL, enc28j60SimPhyRead(sim, REG(MIREGADR)));
+			sim->stats.phyOps++;
+		}
+		break;
+	case MIWRH & ~SPRD_MASK:
+		enc28j60SimPhyWrite(sim, REG(MIREGADR), enc28j60SimWord(sim, MIWRL));
+		sim->stats.phyOps++;
+		break;
+	}
+}
+
+static uint8_t enc28j60SimRegRead(struct enc28j60_sim *sim, uint8_t bank, uint8_t addr)
+{
+	uint8_t v = *enc28j60SimReg(sim, bank, addr);
+
+	if (addr == (EIR & ADDR_MASK)) {
+		v &= ~EIR_PKTIF;
+		if (enc28j60SimPktif(sim))
+			v |= EIR_PKTIF;
+	} else if (addr == (ESTAT & ADDR_MASK)) {
+		v &= ~ESTAT_INT;
+		if (enc28j60SimIntPending(sim))
+			v |= ESTAT_INT;
+		if (sim->clkWait && --sim->clkWait == 0)
+			REG(ESTAT) |= ESTAT_CLKRDY;
+	}
+	return v;
+}
+
+uint8_t enc28j60SimIntPending(struct enc28j60_sim *sim)
+{
+	uint8_t eir = REG(EIR) & ~EIR_PKTIF;
+
+	if (enc28j60SimPktif(sim))
+		eir |= EIR_PKTIF;
+	return (REG(EIE) & EIE_INTIE) && (eir & REG(EIE) & 0x7F);
+}
+
+// one byte on the bus, returns MISO
+static uint8_t enc28j60SimByte(struct enc28j60_sim *sim, uint8_t mosi)
+{
+	uint8_t bank = REG(ECON1) & (ECON1_BSEL1|ECON1_BSEL0);
+	uint16_t a;
+	uint8_t v;
+
+	sim->stats.spiBytes++;
+	switch (sim->cmd) {
+	case SIM_CMD_OPCODE:
+		if (mosi == ENC28J60_SOFT_RESET) {
+			enc28j60SimReset(sim);
+			// the clock restarts, only the errata leaves CLKRDY set
+			if (!enc28j60SimErrata(sim)) {
+				REG(ESTAT) &= ~ESTAT_CLKRDY;
+				sim->clkWait = ENC28J60_SIM_CLKRDY_READS;
+			}
+			sim->cmd = SIM_CMD_DONE;
+			return 0;
+		}
+		sim->cmd = mosi >> 5;
+		sim->arg = mosi & ADDR_MASK;
+		sim->count = 0;
+		return 0;
+	case SIM_OP_RCR:
+		if (enc28j60SimIsMac(bank, sim->arg) && sim->count == 0) {
+			sim->count++;
+			return 0xFF;
+		}
+		return enc28j60SimRegRead(sim, bank, sim->arg);
+	case SIM_OP_RBM:
+		a = enc28j60SimWord(sim, ERDPTL);
+		v = sim->mem[a];
+		if (REG(ECON2) & ECON2_AUTOINC)
+			enc28j60SimSetWord(sim, ERDPTL, enc28j60SimNext(sim, a));
+		return v;
+	case SIM_OP_WBM:
+		a = enc28j60SimWord(sim, EWRPTL);
+		sim->mem[a] = mosi;
+		if (REG(ECON2) & ECON2_AUTOINC)
+			enc28j60SimSetWord(sim, EWRPTL, (a + 1) & SIM_MEM_MASK);
+		return 0;
+	case SIM_OP_WCR:
+	case SIM_OP_BFS:
+	case SIM_OP_BFC:
+		if (sim->count++ == 0)
+			enc28j60SimRegWrite(sim, sim->cmd, bank, sim->arg, mosi);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+// ethernet FCS, reflected CRC-32
+static uint32_t enc28j60SimCrc(const uint8_t *data, uint16_t len)
+{
+	uint32_t crc = 0xffffffff;
+	uint8_t j;
+
+	while (len--) {
+		crc ^= *data++;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	}
+	return crc;
+}
+
+// pattern match: checksum of the EPMM selected bytes of the 64 at EPMO
+static uint8_t enc28j60SimPatternMatch(struct enc28j60_sim *sim, const uint8_t *frame, uint16_t wire)
+{
+	uint16_t offset = enc28j60SimWord(sim, EPMOL);
+	uint32_t sum = 0;
+	uint8_t i, n = 0;
+
+	if (wire < offset + 64)
+		return 0;
+	for (i = 0; i < 64; i++) {
+		if (REG(EPMM0 + i / 8) & (1 << (i % 8))) {
+			sum += (n & 1) ? frame[offset + i] : (uint16_t)frame[offset + i] << 8;
+			n++;
+		}
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (~sum & 0xffff) == enc28j60SimWord(sim, EPMCSL);
+}
+
+static uint8_t enc28j60SimHashMatch(struct enc28j60_sim *sim, const uint8_t *frame)
+{
+	uint32_t crc = enc28j60SimCrc(frame, 6);
+	uint8_t ptr = 0, i;
+
+	// bits 28:23 of the msb first CRC are bits 3:8 of the reflected one
+	for (i = 0; i < 6; i++)
+		ptr |= ((crc >> (3 + i)) & 1) << (5 - i);
+	return (REG(EHT0 + ptr / 8) >> (ptr % 8)) & 1;
+}
+
+// ERXFCON: any enabled filter (OR) or all of them (ANDOR) must accept
+static uint8_t enc28j60SimFilter(struct enc28j60_sim *sim, const uint8_t *frame, uint16_t wire)
+{
+	uint8_t fcon = REG(ERXFCON);
+	uint8_t bcast = memcmp(frame, "\xff\xff\xff\xff\xff\xff", 6) == 0;
+	uint8_t enabled = fcon & (ERXFCON_UCEN|ERXFCON_PMEN|ERXFCON_MPEN|ERXFCON_HTEN|ERXFCON_MCEN|ERXFCON_BCEN);
+	uint8_t hit = 0;
+	uint8_t mac[6];
+
+	if (!enabled)
+		return 1;
+	mac[0] = REG(MAADR5);
+	mac[1] = REG(MAADR4);
+	mac[2] = REG(MAADR3);
+	mac[3] = REG(MAADR2);
+	mac[4] = REG(MAADR1);
+	mac[5] = REG(MAADR0);
+	if ((fcon & ERXFCON_UCEN) && memcmp(frame, mac, 6) == 0)
+		hit |= ERXFCON_UCEN;
+	if ((fcon & ERXFCON_PMEN) && enc28j60SimPatternMatch(sim, frame, wire))
+		hit |= ERXFCON_PMEN;
+	if ((fcon & ERXFCON_HTEN) && enc28j60SimHashMatch(sim, frame))
+		hit |= ERXFCON_HTEN;
+	if ((fcon & ERXFCON_MCEN) && (frame[0] & 1) && !bcast)
+		hit |= ERXFCON_MCEN;
+	if ((fcon & ERXFCON_BCEN) && bcast)
+		hit |= ERXFCON_BCEN;
+	if (fcon & ERXFCON_ANDOR)
+		return hit == enabled;
+	return hit != 0;
+}
+
+uint8_t enc28j60SimInject(struct enc28j60_sim *sim, const uint8_t *frame, uint16_t len)
+{
+	static uint8_t buf[ENC28J60_SIM_MEM_SIZE];
+	uint16_t rxst = enc28j60SimWord(sim, ERXSTL);
+	uint16_t rxnd = enc28j60SimWord(sim, ERXNDL);
+	uint16_t wr = enc28j60SimWord(sim, ERXWRPTL);
+	uint16_t rd = enc28j60SimWord(sim, ERXRDPTL);
+	uint16_t size, space, wire, need, next, stat, i, a;
+	uint32_t crc;
+	uint8_t hdr[6];
+
+	if (len < 14 || len > ENC28J60_SIM_MEM_SIZE - 4)
+		return 0;
+	if (!(REG(ECON1) & ECON1_RXEN) || (REG(ECON1) & ECON1_RXRST)
+	    || !(REG(MACON1) & MACON1_MARXEN)) {
+		sim->stats.rxDropped++;
+		return 0;
+	}
+	memcpy(buf, frame, len);
+	if (len < 60) {
+		memset(buf + len, 0, 60 - len);
+		len = 60;
+	}
+	crc = ~enc28j60SimCrc(buf, len);
+	for (i = 0; i < 4; i++)
+		buf[len + i] = crc >> (8 * i);
+	wire = len + 4;
+
+	if (!enc28j60SimFilter(sim, buf, wire)) {
+		sim->stats.rxFiltered++;
+		return 0;
+	}
+
+	// the hardware stops one byte before ERXRDPT
+	size = rxnd - rxst + 1;
+	if (rd == wr)
+		space = size;
+	else if (rd > wr)
+		space = rd - wr;
+	else
+		space = size - (wr - rd);
+	// frames start at even addresses
+	need = 6 + wire + ((6 + wire) & 1);
+	if (REG(EPKTCNT) == 0xff || need >= space) {
+		REG(EIR) |= EIR_RXERIF;
+		sim->stats.rxDropped++;
+		return 0;
+	}
+
+	next = wr;
+	for (i = 0; i < need; i++)
+		next = enc28j60SimNext(sim, next);
+	stat = ENC28J60_RXSTAT_OK;
+	if (buf[0] & 1)
+		stat |= memcmp(buf, "\xff\xff\xff\xff\xff\xff", 6) == 0 ?
+			ENC28J60_RXSTAT_BROADCAST : ENC28J60_RXSTAT_MULTICAST;
+	hdr[0] = next & 0xff;
+	hdr[1] = next >> 8;
+	if (sim->rdptCorrupt)
+		hdr[1] ^= 0x15;
+	hdr[2] = wire & 0xff;
+	hdr[3] = wire >> 8;
+	hdr[4] = stat & 0xff;
+	hdr[5] = stat >> 8;
+
+	a = wr;
+	for (i = 0; i < 6; i++, a = enc28j60SimNext(sim, a))
+		sim->mem[a] = hdr[i];
+	for (i = 0; i < wire; i++, a = enc28j60SimNext(sim, a))
+		sim->mem[a] = buf[i];
+	enc28j60SimSetWord(sim, ERXWRPTL, next);
+	REG(EPKTCNT)++;
+	sim->pktif = 1;
+	sim->stats.rxFrames++;
+	return 1;
+}
+
+static struct enc28j60_sim *enc28j60SimOf(struct enc28j60_dev *d)
+{
+	return d->spiCtx;
+}
+
+static void enc28j60SimSpiInit(struct enc28j60_dev *d)
+{
+	(void)d;
+}
+
+static void enc28j60SimSelect(struct enc28j60_dev *d)
+{
+	struct enc28j60_sim *sim = enc28j60SimOf(d);
+
+	sim->cmd = SIM_CMD_OPCODE;
+	sim->stats.spiTransactions++;
+}
+
+static void enc28j60SimRelease(struct enc28j60_dev *d)
+{
+	enc28j60SimOf(d)->cmd = SIM_CMD_DONE;
+}
+
+// a transfer the bus lost: nothing reaches the chip, MISO stays high
+static uint8_t enc28j60SimSpiFail(struct enc28j60_sim *sim, uint8_t *rx, uint16_t len)
+{
+	if (sim->spiErrors == 0)
+		return 0;
+	sim->spiErrors--;
+	if (rx)
+		memset(rx, 0xff, len);
+	ENC28j60_Error_Handler(SPI_ERROR);
+	return 1;
+}
+
+static void enc28j60SimTransfer(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	struct enc28j60_sim *sim = enc28j60SimOf(d);
+	uint16_t i;
+
+	if (enc28j60SimSpiFail(sim, rx, len))
+		return;
+
+	for (i = 0; i < len; i++) {
+		uint8_t v = enc28j60SimByte(sim, tx[i]);
+		if (rx)
+			rx[i] = v;
+	}
+}
+
+static void enc28j60SimRead(struct enc28j60_dev *d, uint8_t *data, uint16_t len)
+{
+	struct enc28j60_sim *sim = enc28j60SimOf(d);
+
+	if (enc28j60SimSpiFail(sim, data, len))
+		return;
+
+	while (len--)
+		*data++ = enc28j60SimByte(sim, 0);
+}
+
+static void enc28j60SimWrite(struct enc28j60_dev *d, const uint8_t *data, uint16_t len)
+{
+	struct enc28j60_sim *sim = enc28j60SimOf(d);
+
+	if (enc28j60SimSpiFail(sim, NULL, len))
+		return;
+
+	while (len--)
+		enc28j60SimByte(sim, *data++);
+}
+
+const struct enc28j60_spi_ops enc28j60SpiSim = {
+	.init = enc28j60SimSpiInit,
+	.select = enc28j60SimSelect,
+	.release = enc28j60SimRelease,
+	.transfer = enc28j60SimTransfer,
+	.read = enc28j60SimRead,
+	.write = enc28j60SimWrite,
+};
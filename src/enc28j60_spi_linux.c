@@ -0,0 +1,103 @@
+#include "enc28j60.h"
+#include "error_handler.h"
+
+#if ENC28J60_HOST
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+// Linux spidev transport. Each call is one ioctl; cs_change on the last
+// (only) transfer of a message keeps CS asserted after it, so a command
+// byte and the data that follows stay in one chip transaction. release
+// sends an empty transfer without cs_change to drop CS.
+
+static struct enc28j60_spidev enc28j60SpidevDefault = {
+	.path = ETHERNET_SPIDEV,
+	.speed = ETHERNET_SPIDEV_HZ,
+	.fd = -1,
+};
+
+static struct enc28j60_spidev *enc28j60Spidev(struct enc28j60_dev *d)
+{
+	if (d->spiCtx == NULL)
+		d->spiCtx = &enc28j60SpidevDefault;
+	return d->spiCtx;
+}
+
+static void enc28j60SpidevInit(struct enc28j60_dev *d)
+{
+	struct enc28j60_spidev *s = enc28j60Spidev(d);
+	uint8_t mode = SPI_MODE_0;
+	uint8_t bits = 8;
+
+	if (s->fd >= 0)
+		return;
+	s->fd = open(s->path, O_RDWR);
+	if (s->fd < 0
+	    || ioctl(s->fd, SPI_IOC_WR_MODE, &mode) < 0
+	    || ioctl(s->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+	    || ioctl(s->fd, SPI_IOC_WR_MAX_SPEED_HZ, &s->speed) < 0)
+		ENC28j60_Error_Handler(SPI_ERROR);
+}
+
+static void enc28j60SpidevMessage(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len, uint8_t hold)
+{
+	struct enc28j60_spidev *s = enc28j60Spidev(d);
+	struct spi_ioc_transfer t;
+
+	if (s->fd < 0)
+		return;
+	memset(&t, 0, sizeof(t));
+	t.tx_buf = (unsigned long)tx;
+	t.rx_buf = (unsigned long)rx;
+	t.len = len;
+	t.speed_hz = s->speed;
+	t.bits_per_word = 8;
+	t.cs_change = hold;
+	if (ioctl(s->fd, SPI_IOC_MESSAGE(1), &t) < 0)
+		ENC28j60_Error_Handler(SPI_ERROR);
+}
+
+// CS goes low with the first transfer
+static void enc28j60SpidevSelect(struct enc28j60_dev *d)
+{
+	(void)d;
+}
+
+static void enc28j60SpidevRelease(struct enc28j60_dev *d)
+{
+	enc28j60SpidevMessage(d, NULL, NULL, 0, 0);
+}
+
+static void enc28j60SpidevTransfer(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	if (len)
+		enc28j60SpidevMessage(d, tx, rx, len, 1);
+}
+
+// spidev clocks out zeros when there is no tx buffer
+static void enc28j60SpidevRead(struct enc28j60_dev *d, uint8_t *data, uint16_t len)
+{
+	if (len)
+		enc28j60SpidevMessage(d, NULL, data, len, 1);
+}
+
+static void enc28j60SpidevWrite(struct enc28j60_dev *d, const uint8_t *data, uint16_t len)
+{
+	if (len)
+		enc28j60SpidevMessage(d, data, NULL, len, 1);
+}
+
+const struct enc28j60_spi_ops enc28j60SpiLinux = {
+	.init = enc28j60SpidevInit,
+	.select = enc28j60SpidevSelect,
+	.release = enc28j60SpidevRelease,
+	.transfer = enc28j60SpidevTransfer,
+	.read = enc28j60SpidevRead,
+	.write = enc28j60SpidevWrite,
+};
+
+#endif /* ENC28J60_HOST */
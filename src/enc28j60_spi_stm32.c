@@ -0,0 +1,232 @@
+#include "enc28j60.h"
+#include "error_handler.h"
+
+#if !ENC28J60_HOST
+
+// chip select and the activity LED
+static void enc28j60StmSelect(struct enc28j60_dev *d)
+{
+	enc28j60PortPinLow(d->csPort, d->csPin);
+	if (d->ledPort)
+		enc28j60PortPinHigh(d->ledPort, d->ledPin);
+}
+
+static void enc28j60StmRelease(struct enc28j60_dev *d)
+{
+	enc28j60PortPinHigh(d->csPort, d->csPin);
+	if (d->ledPort)
+		enc28j60PortPinLow(d->ledPort, d->ledPin);
+}
+
+static void enc28j60HalInit(struct enc28j60_dev *d)
+{
+	(void)d;
+}
+
+static void enc28j60HalTransfer(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	HAL_StatusTypeDef r;
+
+	if (d->hspi == NULL || len == 0)
+		return;
+	// nothing useful comes back on MISO, so it is not read at all
+	if (rx == NULL)
+		r = HAL_SPI_Transmit(d->hspi, (uint8_t *)tx, len, 0xffffffff);
+	else
+		r = HAL_SPI_TransmitReceive(d->hspi, (uint8_t *)tx, rx, len, 0xffffffff);
+	if (r != HAL_OK)
+		ENC28j60_Error_Handler(SPI_ERROR);
+}
+
+// Bulk transfers of buffer memory: the whole payload goes to HAL in one call
+// instead of one HAL round trip per byte.
+// In master full-duplex mode HAL_SPI_Receive clocks out the receive buffer
+// itself as dummy bytes, the chip ignores MOSI while in RBM mode.
+static void enc28j60HalRead(struct enc28j60_dev *d, uint8_t *data, uint16_t len)
+{
+	if (d->hspi == NULL || len == 0)
+		return;
+
+	if (HAL_SPI_Receive(d->hspi, data, len, 0xffffffff) != HAL_OK)
+		ENC28j60_Error_Handler(SPI_ERROR);
+}
+
+static void enc28j60HalWrite(struct enc28j60_dev *d, const uint8_t *data, uint16_t len)
+{
+	if (d->hspi == NULL || len == 0)
+		return;
+
+	if (HAL_SPI_Transmit(d->hspi, (uint8_t *)data, len, 0xffffffff) != HAL_OK)
+		ENC28j60_Error_Handler(SPI_ERROR);
+}
+
+#if ETHERNET_SPI_DMA
+// Without a handle there is nothing to transfer and asyncBusy reports the
+// transfer done right away.
+static uint8_t enc28j60HalReadAsync(struct enc28j60_dev *d, uint8_t *data, uint16_t len)
+{
+	if (d->hspi == NULL)
+		return 0;
+	return HAL_SPI_Receive_DMA(d->hspi, data, len) != HAL_OK;
+}
+
+static uint8_t enc28j60HalWriteAsync(struct enc28j60_dev *d, const uint8_t *data, uint16_t len)
+{
+	if (d->hspi == NULL)
+		return 0;
+	return HAL_SPI_Transmit_DMA(d->hspi, (uint8_t *)data, len) != HAL_OK;
+}
+
+static uint8_t enc28j60HalAsyncBusy(struct enc28j60_dev *d)
+{
+	return d->hspi != NULL && HAL_SPI_GetState(d->hspi) != HAL_SPI_STATE_READY;
+}
+#else
+#define enc28j60HalReadAsync NULL
+#define enc28j60HalWriteAsync NULL
+#define enc28j60HalAsyncBusy NULL
+#endif
+
+const struct enc28j60_spi_ops enc28j60SpiHal = {
+	.init = enc28j60HalInit,
+	.select = enc28j60StmSelect,
+	.release = enc28j60StmRelease,
+	.transfer = enc28j60HalTransfer,
+	.read = enc28j60HalRead,
+	.write = enc28j60HalWrite,
+	.readAsync = enc28j60HalReadAsync,
+	.writeAsync = enc28j60HalWriteAsync,
+	.asyncBusy = enc28j60HalAsyncBusy,
+};
+
+// Register-level SPI access for the short control operations. HAL costs
+// far more than the 2-3 bytes on the bus, so the data register is driven
+// directly here polling TXE/RXNE. The peripheral is configured by HAL and
+// enabled in init, bulk transfers still go through HAL.
+#define ENC28J60_LL_SPIN 0x10000
+
+static uint8_t enc28j60LLWait(SPI_TypeDef *spi, uint32_t flag)
+{
+	uint32_t n = ENC28J60_LL_SPIN;
+
+	while (!(spi->SR & flag)) {
+		if (--n == 0) {
+			ENC28j60_Error_Handler(SPI_ERROR);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t enc28j60LLWaitIdle(SPI_TypeDef *spi)
+{
+	uint32_t n = ENC28J60_LL_SPIN;
+
+	while (spi->SR & SPI_SR_BSY) {
+		if (--n == 0) {
+			ENC28j60_Error_Handler(SPI_ERROR);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// discard whatever MISO delivered meanwhile and clear the overrun flag
+static inline void enc28j60LLFlush(SPI_TypeDef *spi)
+{
+	while (spi->SR & SPI_SR_RXNE)
+		(void)*(__IO uint8_t *)&spi->DR;
+	(void)spi->SR;
+}
+
+static uint8_t enc28j60LLTransferByte(SPI_TypeDef *spi, uint8_t tx)
+{
+	if (!enc28j60LLWait(spi, SPI_SR_TXE))
+		return 0;
+	*(__IO uint8_t *)&spi->DR = tx;
+	if (!enc28j60LLWait(spi, SPI_SR_RXNE))
+		return 0;
+	return *(__IO uint8_t *)&spi->DR;
+}
+
+#if ETHERNET_SPI_LL_16BIT && defined(SPI_CR1_DFF)
+// One 16-bit frame for op+data pairs. The frame format may only be changed
+// while the peripheral is disabled and HAL expects 8-bit frames back.
+static uint16_t enc28j60LLTransfer16(SPI_TypeDef *spi, uint16_t tx)
+{
+	uint16_t rx = 0;
+
+	spi->CR1 &= ~SPI_CR1_SPE;
+	spi->CR1 |= SPI_CR1_DFF;
+	spi->CR1 |= SPI_CR1_SPE;
+	if (enc28j60LLWait(spi, SPI_SR_TXE)) {
+		spi->DR = tx;
+		if (enc28j60LLWait(spi, SPI_SR_RXNE))
+			rx = spi->DR;
+	}
+	enc28j60LLWaitIdle(spi);
+	spi->CR1 &= ~SPI_CR1_SPE;
+	spi->CR1 &= ~SPI_CR1_DFF;
+	spi->CR1 |= SPI_CR1_SPE;
+	return rx;
+}
+#endif
+
+// make sure the SPI peripheral is enabled before it is used at register level
+static void enc28j60LLInit(struct enc28j60_dev *d)
+{
+	if (d->hspi != NULL && !(d->hspi->Instance->CR1 & SPI_CR1_SPE))
+		__HAL_SPI_ENABLE(d->hspi);
+}
+
+static void enc28j60LLTransfer(struct enc28j60_dev *d, const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	SPI_TypeDef *spi;
+	uint16_t i;
+
+	if (d->hspi == NULL || len == 0)
+		return;
+	spi = d->hspi->Instance;
+
+#if ETHERNET_SPI_LL_16BIT && defined(SPI_CR1_DFF)
+	if (len == 2) {
+		uint16_t w = enc28j60LLTransfer16(spi, (tx[0] << 8) | tx[1]);
+		if (rx != NULL) {
+			rx[0] = w >> 8;
+			rx[1] = w & 0xFF;
+		} else {
+			enc28j60LLFlush(spi);
+		}
+		return;
+	}
+#endif
+	if (rx != NULL) {
+		for (i = 0; i < len; i++)
+			rx[i] = enc28j60LLTransferByte(spi, tx[i]);
+		enc28j60LLWaitIdle(spi);
+		return;
+	}
+	// write only: keep the data register fed, read MISO back once at the end
+	for (i = 0; i < len; i++) {
+		if (!enc28j60LLWait(spi, SPI_SR_TXE))
+			return;
+		*(__IO uint8_t *)&spi->DR = tx[i];
+	}
+	enc28j60LLWait(spi, SPI_SR_TXE);
+	enc28j60LLWaitIdle(spi);
+	enc28j60LLFlush(spi);
+}
+
+const struct enc28j60_spi_ops enc28j60SpiLL = {
+	.init = enc28j60LLInit,
+	.select = enc28j60StmSelect,
+	.release = enc28j60StmRelease,
+	.transfer = enc28j60LLTransfer,
+	.read = enc28j60HalRead,
+	.write = enc28j60HalWrite,
+	.readAsync = enc28j60HalReadAsync,
+	.writeAsync = enc28j60HalWriteAsync,
+	.asyncBusy = enc28j60HalAsyncBusy,
+};
+
+#endif /* !ENC28J60_HOST */
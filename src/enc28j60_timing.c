@@ -0,0 +1,101 @@
+#include "enc28j60.h"
+#include "enc28j60_timing.h"
+
+// ticks of the uncalibrated defaults: one tick is at least one cycle, so
+// the busy loop variant only errs on the long side
+#define ENC28J60_DEFAULT_TICKS_PER_US ((ETHERNET_MCU_CLOCK_HZ + 999999) / 1000000)
+#define ENC28J60_NS_TO_TICKS(ns, per_us) (((ns) * (per_us) + 999) / 1000)
+
+uint32_t enc28j60TicksPerUs = ENC28J60_DEFAULT_TICKS_PER_US;
+uint32_t enc28j60CsDelayTicks = ENC28J60_NS_TO_TICKS(ETHERNET_CS_DELAY_NS, ENC28J60_DEFAULT_TICKS_PER_US);
+uint32_t enc28j60CsHoldTicks = ENC28J60_NS_TO_TICKS(ETHERNET_CS_HOLD_NS, ENC28J60_DEFAULT_TICKS_PER_US);
+
+static uint8_t timingReady;
+
+uint32_t enc28j60NsToTicks(uint32_t ns)
+{
+	return ENC28J60_NS_TO_TICKS(ns, enc28j60TicksPerUs);
+}
+
+void enc28j60DelayNs(uint32_t ns)
+{
+	enc28j60DelayTicks(enc28j60NsToTicks(ns));
+}
+
+// length of the calibration, microseconds of the port clock
+#define ENC28J60_CALIBRATION_US 1000
+
+void enc28j60TimingInit(void)
+{
+	uint32_t ticksPerMs = 0;
+	uint32_t t0, us, n = 0;
+
+	if (timingReady)
+		return;
+
+#if ENC28J60_TIMING_DWT
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// cycles during ENC28J60_CALIBRATION_US
+	t0 = enc28j60PortMicros();
+	uint32_t start = DWT->CYCCNT;
+	do {
+		us = enc28j60PortMicros() - t0;
+	} while (us < ENC28J60_CALIBRATION_US && ++n < ETHERNET_MCU_CLOCK_HZ / 100);
+	if (us >= ENC28J60_CALIBRATION_US)
+		ticksPerMs = (uint64_t)(DWT->CYCCNT - start) * 1000 / us;
+#else
+	// busy loop iterations during ENC28J60_CALIBRATION_US, measured with
+	// the delay loop itself. Reading the clock in between makes the count
+	// come out low, add a margin so the delays err on the long side.
+	t0 = enc28j60PortMicros();
+	do {
+		enc28j60DelayTicks(64);
+		us = enc28j60PortMicros() - t0;
+	} while (us < ENC28J60_CALIBRATION_US && ++n < ETHERNET_MCU_CLOCK_HZ / 1000);
+	if (us >= ENC28J60_CALIBRATION_US) {
+		ticksPerMs = (uint64_t)n * 64 * 1000 / us;
+		ticksPerMs += ticksPerMs / 16;
+	}
+#endif
+
+	// keep the defaults if the clock is not running
+	if (ticksPerMs >= 1000) {
+		enc28j60TicksPerUs = (ticksPerMs + 999) / 1000;
+		enc28j60CsDelayTicks = enc28j60NsToTicks(ETHERNET_CS_DELAY_NS);
+		enc28j60CsHoldTicks = enc28j60NsToTicks(ETHERNET_CS_HOLD_NS);
+	}
+	timingReady = 1;
+}
+
+uint32_t enc28j60BenchmarkRegOps(uint32_t count)
+{
+	uint32_t i;
+
+	if (count == 0)
+		return 0;
+
+#if ENC28J60_TIMING_DWT
+	uint32_t start = DWT->CYCCNT;
+	uint32_t cycles;
+
+	for (i = 0; i < count; i++)
+		enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ESTAT);
+	cycles = DWT->CYCCNT - start;
+	if (cycles == 0)
+		return 0;
+	return (uint32_t)((uint64_t)count * enc28j60TicksPerUs * 1000000 / cycles);
+#else
+	uint32_t start = enc28j60PortMicros();
+	uint32_t us;
+
+	for (i = 0; i < count; i++)
+		enc28j60ReadOp(ENC28J60_READ_CTRL_REG, ESTAT);
+	us = enc28j60PortMicros() - start;
+	if (us == 0)
+		return 0;
+	return (uint32_t)((uint64_t)count * 1000000 / us);
+#endif
+}
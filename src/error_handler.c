@@ -1,6 +1,9 @@
 #include "error_handler.h"
+#include "enc28j60.h"
 
+// The chip is reset and set up again from the main loop, see
+// enc28j60RequestRecovery. Override it to log the error or to stop.
 void __attribute__((weak)) ENC28j60_Error_Handler(enum ENC28j60_Error error)
 {
-    while(1) {}
-}
\ No newline at end of file
+    enc28j60RequestRecovery(error);
+}
@@ -0,0 +1,211 @@
+/*********************************************
+ * vim:sw=8:ts=8:si:et
+ * To use the above modeline in vim you must have "set modeline" in your .vimrc
+ *
+ * Copyright: GPL V2
+ * See http://www.gnu.org/licenses/gpl.html
+ *
+ * IGMPv2 host side, http://www.ietf.org/rfc/rfc2236.txt
+ *
+ * Instead of accepting all multicast frames (ERXFCON_MCEN) the hash
+ * table filter of the ENC28J60 is programmed with the mac addresses of
+ * the joined groups, so frames of other groups never cross the SPI bus.
+ * The hash is 6 bits wide, frames of groups that share a hash bit are
+ * received too and dropped by the stack.
+ *********************************************/
+#include <string.h>
+#include <stdlib.h>
+#include "net.h"
+#include "enc28j60.h"
+#include "ip_arp_udp_tcp.h"
+#include "igmp.h"
+
+#if defined (IGMP_client)
+
+static const uint8_t igmp_all_hosts[4] = {224, 0, 0, 1};
+static const uint8_t igmp_all_routers[4] = {224, 0, 0, 2};
+
+static struct {
+        uint8_t ip[4];
+        uint8_t used;
+        uint8_t pending;        // report due at reportAt
+        uint32_t reportAt;
+} igmp_groups[IGMP_MAX_GROUPS];
+
+static int8_t igmp_find(const uint8_t *group)
+{
+        uint8_t i;
+        for (i = 0; i < IGMP_MAX_GROUPS; i++) {
+                if (igmp_groups[i].used && !memcmp(igmp_groups[i].ip, group, 4)) {
+                        return (i);
+                }
+        }
+        return (-1);
+}
+
+static void igmp_hash_add(uint8_t *table, const uint8_t *group)
+{
+        uint8_t mac[6] = {0x01, 0x00, 0x5e, group[1] & 0x7f, group[2], group[3]};
+        uint8_t bit = enc28j60HashIndex(mac);
+        table[bit >> 3] |= 1 << (bit & 7);
+}
+
+// rebuild the hash table from the joined groups
+static void igmp_update_filter(void)
+{
+        uint8_t table[8];
+        uint8_t i, any = 0;
+
+        memset(table, 0, sizeof(table));
+        for (i = 0; i < IGMP_MAX_GROUPS; i++) {
+                if (igmp_groups[i].used) {
+                        igmp_hash_add(table, igmp_groups[i].ip);
+                        any = 1;
+                }
+        }
+        // queries go to all hosts
+        if (any) {
+                igmp_hash_add(table, igmp_all_hosts);
+        }
+        enc28j60SetHashTable(table);
+}
+
+static void igmp_send(uint8_t *buf, uint8_t type, const uint8_t *dip, const uint8_t *group)
+{
+        uint16_t ck;
+        make_ip_igmp_new(buf, dip);
+        buf[IGMP_TYPE_P] = type;
+        buf[IGMP_MAXRESP_P] = 0;
+        buf[IGMP_CHECKSUM_H_P] = 0;
+        buf[IGMP_CHECKSUM_L_P] = 0;
+        memcpy(&buf[IGMP_GROUP_P], group, 4);
+        ck = checksum(&buf[IGMP_P], IGMP_HEADER_LEN, 0);
+        buf[IGMP_CHECKSUM_H_P] = ck >> 8;
+        buf[IGMP_CHECKSUM_L_P] = ck & 0xff;
+        enc28j60PacketSend(ETH_HEADER_LEN + IGMP_IP_HEADER_LEN + IGMP_HEADER_LEN, buf);
+}
+
+// report within a random time up to maxdelay ms, keep an earlier one
+static void igmp_schedule(uint8_t i, uint32_t maxdelay)
+{
+        uint32_t at = enc28j60PortMillis() + (maxdelay ? (uint32_t)rand() % maxdelay : 0);
+
+        if (!igmp_groups[i].pending || (int32_t)(at - igmp_groups[i].reportAt) < 0) {
+                igmp_groups[i].reportAt = at;
+                igmp_groups[i].pending = 1;
+        }
+}
+
+uint8_t igmp_is_member(const uint8_t *group)
+{
+        return (igmp_find(group) >= 0);
+}
+
+uint8_t igmp_join(uint8_t *buf, const uint8_t *group)
+{
+        uint8_t i;
+
+        if ((group[0] & 0xf0) != 0xe0) {
+                return (0);
+        }
+        if (igmp_find(group) >= 0) {
+                return (1);
+        }
+        for (i = 0; i < IGMP_MAX_GROUPS; i++) {
+                if (!igmp_groups[i].used) {
+                        break;
+                }
+        }
+        if (i == IGMP_MAX_GROUPS) {
+                return (0);
+        }
+        memcpy(igmp_groups[i].ip, group, 4);
+        igmp_groups[i].used = 1;
+        igmp_groups[i].pending = 0;
+        igmp_update_filter();
+        // the first report may get lost, it is repeated once
+        igmp_send(buf, IGMP_TYPE_REPORT_V2_V, group, group);
+        igmp_schedule(i, IGMP_UNSOLICITED_INTERVAL);
+        return (1);
+}
+
+void igmp_leave(uint8_t *buf, const uint8_t *group)
+{
+        int8_t i = igmp_find(group);
+
+        if (i < 0) {
+                return;
+        }
+        igmp_groups[i].used = 0;
+        igmp_groups[i].pending = 0;
+        igmp_update_filter();
+        igmp_send(buf, IGMP_TYPE_LEAVE_V, igmp_all_routers, group);
+}
+
+uint8_t igmp_wanted(uint8_t *buf, uint16_t plen)
+{
+        if (plen < IP_DST_P + 4 || buf[ETH_TYPE_H_P] != ETHTYPE_IP_H_V || buf[ETH_TYPE_L_P] != ETHTYPE_IP_L_V) {
+                return (0);
+        }
+        if (buf[IP_PROTO_P] == IP_PROTO_IGMP_V) {
+                return (1);
+        }
+        return (igmp_find(&buf[IP_DST_P]) >= 0);
+}
+
+uint8_t igmp_packet(uint8_t *buf, uint16_t plen)
+{
+        uint8_t *igmp;
+        uint32_t maxdelay;
+        uint8_t i;
+        int8_t g;
+
+        if (plen < IP_P + IP_HEADER_LEN || buf[ETH_TYPE_H_P] != ETHTYPE_IP_H_V || buf[ETH_TYPE_L_P] != ETHTYPE_IP_L_V
+            || buf[IP_PROTO_P] != IP_PROTO_IGMP_V) {
+                return (0);
+        }
+        // queries come with the router alert option
+        igmp = &buf[IP_P + (buf[IP_HEADER_LEN_VER_P] & 0x0f) * 4];
+        if (igmp + IGMP_HEADER_LEN > buf + plen) {
+                return (1);
+        }
+        switch (igmp[0]) {
+        case IGMP_TYPE_QUERY_V:
+                // max response time in 1/10 s, 0 is an IGMPv1 query (10 s)
+                maxdelay = igmp[1] ? igmp[1] * 100UL : 10000;
+                for (i = 0; i < IGMP_MAX_GROUPS; i++) {
+                        if (!igmp_groups[i].used) {
+                                continue;
+                        }
+                        // general query (group 0) or one for this group
+                        if (!(igmp[4] | igmp[5] | igmp[6] | igmp[7]) || !memcmp(igmp_groups[i].ip, &igmp[4], 4)) {
+                                igmp_schedule(i, maxdelay);
+                        }
+                }
+                break;
+        case IGMP_TYPE_REPORT_V1_V:
+        case IGMP_TYPE_REPORT_V2_V:
+                // another member answered, the router needs only one
+                g = igmp_find(&igmp[4]);
+                if (g >= 0) {
+                        igmp_groups[g].pending = 0;
+                }
+                break;
+        }
+        return (1);
+}
+
+void igmp_poll(uint8_t *buf)
+{
+        uint32_t now = enc28j60PortMillis();
+        uint8_t i;
+
+        for (i = 0; i < IGMP_MAX_GROUPS; i++) {
+                if (igmp_groups[i].used && igmp_groups[i].pending && (int32_t)(now - igmp_groups[i].reportAt) >= 0) {
+                        igmp_groups[i].pending = 0;
+                        igmp_send(buf, IGMP_TYPE_REPORT_V2_V, igmp_groups[i].ip, igmp_groups[i].ip);
+                }
+        }
+}
+
+#endif /* IGMP_client */
@@ -23,6 +23,9 @@
 #include "net.h"
 #include "enc28j60.h"
 #include "ip_arp_udp_tcp.h"
+#ifdef IGMP_client
+#include "igmp.h"
+#endif
 
 
 #if ETHERSHIELD_DEBUG
@@ -31,9 +34,6 @@ void ethershieldDebug(char *message) {
 }
 #endif
 
-// Web server port, used when implementing webserver
-static uint8_t wwwport_l=80; // server port
-static uint8_t wwwport_h=0;  // Note: never use same as TCPCLIENT_SRC_PORT_H
 
 #if defined (WWW_client) || defined (TCP_client) 
 
@@ -75,14 +75,16 @@ static void (*icmp_callback)(uint8_t *ip);
 #define WGW_HAVE_GW_MAC 2
 #define WGW_REFRESHING 4
 #define WGW_ACCEPT_ARP_REPLY 8
-static int16_t delaycnt=0;
-static uint8_t gwip[4];
-static uint8_t gwmacaddr[6];
 static uint8_t tcpsrvip[4];
-static volatile uint8_t waitgwmac=WGW_INITIAL_ARP;
 
-uint8_t macaddr[6];
-static uint8_t ipaddr[4];
+// the default interface and the one the stack works on, see ip_if_select
+static struct ip_interface default_if = {
+  .dev = &enc28j60DefaultDev,
+  .wwwport_l = 80,
+  .waitgwmac = WGW_INITIAL_ARP,
+};
+static struct ip_interface *ifc = &default_if;
+
 static uint16_t info_data_len=0;
 static uint8_t seqnum=0xa; // my initial tcp sequence number
 
@@ -99,6 +101,106 @@ const char ntpreqhdr[] ={0xe3,0,4,0xfa,0,1,0,1,0,0};
 
 #ifndef DISABLE_IP_STACK
 
+// The words are added in the byte order of the CPU and swapped once at the
+// end, the one's complement sum does not depend on the byte order (RFC 1071
+// section 2). A buffer starting at an odd address is added in pairs
+// shifted by one byte, which is undone by one more swap.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CSUM_BYTE_HI(b) ((uint32_t)(b))
+#define CSUM_BYTE_LO(b) ((uint32_t)(b)<<8)
+#define CSUM_SWAP 0
+#else
+#define CSUM_BYTE_HI(b) ((uint32_t)(b)<<8)
+#define CSUM_BYTE_LO(b) ((uint32_t)(b))
+#define CSUM_SWAP 1
+#endif
+
+// sum of the big endian 16bit words in buf, folded to 16 bit
+static uint16_t checksum_add(const uint8_t *buf, uint16_t len)
+{
+  uint8_t swap = CSUM_SWAP;
+  uint64_t sum = 0;
+  uint32_t w0;
+  uint16_t h;
+
+  // head: up to the next 4 byte boundary
+  if (((uintptr_t)buf & 1) && len){
+    // the second half of the word at buf-1
+    sum += CSUM_BYTE_HI(*buf);
+    buf++;
+    len--;
+    swap ^= 1;
+  }
+  if (((uintptr_t)buf & 2) && len>1){
+    memcpy(&h,buf,2);
+    sum += h;
+    buf+=2;
+    len-=2;
+  }
+#if ETHERNET_CSUM_DSP
+  // UXTAB16 adds byte 0 and 2 of a word to the two halfwords of the
+  // accumulator, the same after a rotation by 8 adds byte 1 and 3. A
+  // halfword takes 256 bytes before it could overflow.
+  while (len>=4){
+    uint32_t lo = 0, hi = 0;
+    uint16_t n = len>>2;
+
+    if (n>256){
+      n=256;
+    }
+    len-=n<<2;
+    while (n--){
+      memcpy(&w0,buf,4);
+      lo = __UXTAB16(lo, w0);
+      hi = __UXTAB16(hi, __ROR(w0, 8));
+      buf+=4;
+    }
+    sum += (lo & 0xFFFF) + (lo >> 16) + (((hi & 0xFFFF) + (hi >> 16)) << 8);
+  }
+#else
+  // the carries are collected in the upper half of sum and added once
+  while (len>=16){
+    uint32_t w1, w2, w3;
+
+    memcpy(&w0,buf,4);
+    memcpy(&w1,buf+4,4);
+    memcpy(&w2,buf+8,4);
+    memcpy(&w3,buf+12,4);
+    sum += w0;
+    sum += w1;
+    sum += w2;
+    sum += w3;
+    buf+=16;
+    len-=16;
+  }
+  while (len>=4){
+    memcpy(&w0,buf,4);
+    sum += w0;
+    buf+=4;
+    len-=4;
+  }
+#endif
+  // tail
+  if (len>1){
+    memcpy(&h,buf,2);
+    sum += h;
+    buf+=2;
+    len-=2;
+  }
+  if (len){
+    sum += CSUM_BYTE_LO(*buf);
+  }
+  sum = (sum & 0xFFFFFFFF)+(sum >> 32);
+  sum = (sum & 0xFFFFFFFF)+(sum >> 32);
+  sum = (sum & 0xFFFF)+(sum >> 16);
+  sum = (sum & 0xFFFF)+(sum >> 16);
+  sum = (sum & 0xFFFF)+(sum >> 16);
+  if (swap){
+    sum = ((sum & 0xFF) << 8) | (sum >> 8);
+  }
+  return (uint16_t)sum;
+}
+
 // The Ip checksum is calculated over the ip header only starting
 // with the header length field and a total length of 20 bytes
 // unitl ip.dst
@@ -145,16 +247,8 @@ uint16_t checksum(uint8_t *buf, uint16_t len,uint8_t type)
     // =length given to this function - (IP.scr+IP.dst length)
     sum+=len-8; // = real tcp len
   }
-  // build the sum of 16bit words
-  while(len >1){
-    sum += 0xFFFF & (((uint32_t)*buf<<8)|*(buf+1));
-    buf+=2;
-    len-=2;
-  }
-  // if there is a byte left then add it (padded with zero)
-  if (len){
-    sum += ((uint32_t)(0xFF & *buf))<<8;
-  }
+  // build the sum of 16bit words, a byte left is padded with zero
+  sum += checksum_add(buf,len);
   // now calculate the sum over the bytes in the sum
   // until the result is only 16bit long
   while (sum>>16){
@@ -166,14 +260,59 @@ uint16_t checksum(uint8_t *buf, uint16_t len,uint8_t type)
 
 #endif
 
+// Fill in the udp (type 1) or tcp (type 2) checksum at ck_p and send the
+// frame of framelen bytes. len is the same as for checksum(): 8 + udp/tcp length.
+static void send_with_checksum(uint8_t *buf,uint16_t len,uint8_t type,uint8_t ck_p,uint16_t framelen)
+{
+  uint16_t ck;
+#if ETHERNET_CSUM_OFFLOAD
+  if (len>=ETHERNET_CSUM_OFFLOAD_MIN){
+    // the chip sums up ip.src to the end of the frame, the checksum
+    // field carries the rest of the pseudo header (protocol and length)
+    ck=(type==1?IP_PROTO_UDP_V:IP_PROTO_TCP_V)+len-8;
+    buf[ck_p]=ck>>8;
+    buf[ck_p+1]=ck& 0xff;
+    enc28j60PacketSendCsum(framelen,buf,IP_SRC_P,len,ck_p);
+    return;
+  }
+#endif
+  buf[ck_p]=0;
+  buf[ck_p+1]=0;
+  ck=checksum(&buf[IP_SRC_P], len,type);
+  buf[ck_p]=ck>>8;
+  buf[ck_p+1]=ck& 0xff;
+  enc28j60PacketSend(framelen,buf);
+}
+
+// set up an interface on dev with the defaults of init_ip_arp_udp_tcp
+void ip_if_init(struct ip_interface *i, struct enc28j60_dev *dev)
+{
+  memset(i, 0, sizeof(*i));
+  i->dev = dev;
+  i->wwwport_l = 80;
+  i->waitgwmac = WGW_INITIAL_ARP;
+}
+
+// work on interface i and its chip from now on
+void ip_if_select(struct ip_interface *i)
+{
+  ifc = i;
+  enc28j60SelectDevice(i->dev);
+}
+
+struct ip_interface *ip_if_current(void)
+{
+  return ifc;
+}
+
 // This initializes the web server
 // you must call this function once before you use any of the other functions:
 void init_ip_arp_udp_tcp(uint8_t *mymac,uint8_t *myip,uint16_t port)
 {
-  wwwport_h=(port>>8)&0xff;
-  wwwport_l=(port&0xff);
-  memcpy(ipaddr, myip, 4);
-  memcpy(macaddr, mymac, 6);
+  ifc->wwwport_h=(port>>8)&0xff;
+  ifc->wwwport_l=(port&0xff);
+  memcpy(ifc->ipaddr, myip, 4);
+  memcpy(ifc->macaddr, mymac, 6);
 }
 
 #ifndef DISABLE_IP_STACK
@@ -193,7 +332,7 @@ uint8_t eth_type_is_arp_and_my_ip(uint8_t *buf,uint16_t len){
           return(0);
   }
   
-  if (memcmp(&buf[ETH_ARP_DST_IP_P], ipaddr, 4)) {
+  if (memcmp(&buf[ETH_ARP_DST_IP_P], ifc->ipaddr, 4)) {
     return 0;
   }
 
@@ -213,7 +352,7 @@ uint8_t eth_type_is_ip_and_my_ip(uint8_t *buf,uint16_t len){
           // must be IP V4 and 20 byte header
           return(0);
   }
-  if (memcmp(&buf[IP_DST_P], ipaddr, 4)) {
+  if (memcmp(&buf[IP_DST_P], ifc->ipaddr, 4)) {
     return 0;
   }
   return(1);
@@ -224,7 +363,7 @@ void make_eth(uint8_t *buf)
 {
   //copy the destination mac from the source and fill my mac into src
   memcpy(&buf[ETH_DST_MAC], &buf[ETH_SRC_MAC], 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
 }
 
 // make a new eth header for IP packet
@@ -232,7 +371,7 @@ void make_eth_ip_new(uint8_t *buf, uint8_t* dst_mac)
 {
   //copy the destination mac from the source and fill my mac into src
   memcpy(&buf[ETH_DST_MAC], dst_mac, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
 
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
@@ -299,7 +438,7 @@ void make_ip_tcp_new(uint8_t *buf, uint16_t len,uint8_t *dst_ip)
 
   // set source and destination ip address
   memcpy(&buf[IP_DST_P], dst_ip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
 }
 
@@ -307,7 +446,7 @@ void make_ip_tcp_new(uint8_t *buf, uint16_t len,uint8_t *dst_ip)
 void make_ip(uint8_t *buf)
 {
   memcpy(&buf[IP_DST_P], &buf[IP_SRC_P], 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
 }
 
@@ -373,15 +512,16 @@ void make_arp_answer_from_request(uint8_t *buf)
   buf[ETH_ARP_OPCODE_L_P]=ETH_ARP_OPCODE_REPLY_L_V;
   // fill the mac addresses:
   memcpy(&buf[ETH_ARP_DST_MAC_P], &buf[ETH_ARP_SRC_MAC_P], 6);
-  memcpy(&buf[ETH_ARP_SRC_MAC_P], macaddr, 6);
+  memcpy(&buf[ETH_ARP_SRC_MAC_P], ifc->macaddr, 6);
   // fill the ip addresses
   memcpy(&buf[ETH_ARP_DST_IP_P], &buf[ETH_ARP_SRC_IP_P], 4);
-  memcpy(&buf[ETH_ARP_SRC_IP_P], ipaddr, 4);
+  memcpy(&buf[ETH_ARP_SRC_IP_P], ifc->ipaddr, 4);
   // eth+arp is 42 bytes:
   enc28j60PacketSend(42,buf); 
 }
 
-void make_echo_reply_from_request(uint8_t *buf,uint16_t len)
+// turn the headers of an echo request into the reply, the payload is not touched
+static void make_echo_reply_head(uint8_t *buf)
 {
   make_eth(buf);
   make_ip(buf);
@@ -392,14 +532,17 @@ void make_echo_reply_from_request(uint8_t *buf,uint16_t len)
           buf[ICMP_CHECKSUM_P+1]++;
   }
   buf[ICMP_CHECKSUM_P]+=0x08;
-  //
+}
+
+void make_echo_reply_from_request(uint8_t *buf,uint16_t len)
+{
+  make_echo_reply_head(buf);
   enc28j60PacketSend(len,buf);
 }
 
 // you can send a max of 220 bytes of data
 void make_udp_reply_from_request(uint8_t *buf,char *data,uint16_t datalen,uint16_t port)
 {
-  uint16_t ck;
   make_eth(buf);
   if (datalen>220){
     datalen=220;
@@ -425,10 +568,7 @@ void make_udp_reply_from_request(uint8_t *buf,char *data,uint16_t datalen,uint16
   // copy the data:
   memcpy(&buf[UDP_DATA_P], data, datalen);
   
-  ck=checksum(&buf[IP_SRC_P], 16 + datalen,1);
-  buf[UDP_CHECKSUM_H_P]=ck>>8;
-  buf[UDP_CHECKSUM_L_P]=ck & 0xff;
-  enc28j60PacketSend(UDP_HEADER_LEN+IP_HEADER_LEN+ETH_HEADER_LEN+datalen,buf);
+  send_with_checksum(buf,16 + datalen,1,UDP_CHECKSUM_H_P,UDP_HEADER_LEN+IP_HEADER_LEN+ETH_HEADER_LEN+datalen);
 }
 
 // this is for the server not the client:
@@ -587,14 +727,8 @@ void make_tcp_ack_with_data_noflags(uint8_t *buf,uint16_t dlen)
   buf[IP_TOTLEN_H_P]=j>>8;
   buf[IP_TOTLEN_L_P]=j& 0xff;
   fill_ip_hdr_checksum(buf);
-  // zero the checksum
-  buf[TCP_CHECKSUM_H_P]=0;
-  buf[TCP_CHECKSUM_L_P]=0;
   // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + data len
-  j=checksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+dlen,2);
-  buf[TCP_CHECKSUM_H_P]=j>>8;
-  buf[TCP_CHECKSUM_L_P]=j& 0xff;
-  enc28j60PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN,buf);
+  send_with_checksum(buf,8+TCP_HEADER_LEN_PLAIN+dlen,2,TCP_CHECKSUM_H_P,IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN);
 }
 
 
@@ -619,14 +753,8 @@ void make_tcp_ack_with_data(uint8_t *buf,uint16_t dlen)
   buf[IP_TOTLEN_H_P]=j>>8;
   buf[IP_TOTLEN_L_P]=j& 0xff;
   fill_ip_hdr_checksum(buf);
-  // zero the checksum
-  buf[TCP_CHECKSUM_H_P]=0;
-  buf[TCP_CHECKSUM_L_P]=0;
   // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + data len
-  j=checksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+dlen,2);
-  buf[TCP_CHECKSUM_H_P]=j>>8;
-  buf[TCP_CHECKSUM_L_P]=j& 0xff;
-  enc28j60PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN,buf);
+  send_with_checksum(buf,8+TCP_HEADER_LEN_PLAIN+dlen,2,TCP_CHECKSUM_H_P,IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN);
 }
 
 
@@ -671,8 +799,8 @@ void client_icmp_request(uint8_t *buf,uint8_t *destip)
 {
   uint16_t ck;
   //
-  memcpy(&buf[ETH_DST_MAC], gwmacaddr, 6); // gw mac in local lan or host mac
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_DST_MAC], ifc->gwmacaddr, 6); // gw mac in local lan or host mac
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
@@ -680,7 +808,7 @@ void client_icmp_request(uint8_t *buf,uint8_t *destip)
   buf[IP_TOTLEN_L_P]=0x82;        // TUX Code has 0x54, here has 0x82
   buf[IP_PROTO_P]=IP_PROTO_UDP_V;
   memcpy(&buf[IP_DST_P], destip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
   
   buf[ICMP_TYPE_P]=ICMP_TYPE_ECHOREQUEST_V;
@@ -690,7 +818,7 @@ void client_icmp_request(uint8_t *buf,uint8_t *destip)
   buf[ICMP_CHECKSUM_L_P]=0;
   // a possibly unique id of this host:
   buf[ICMP_IDENT_H_P]=5; // some number 
-  buf[ICMP_IDENT_L_P]=ipaddr[3]; // last byte of my IP
+  buf[ICMP_IDENT_L_P]=ifc->ipaddr[3]; // last byte of my IP
   //
   buf[ICMP_IDENT_L_P+1]=0; // seq number, high byte
   buf[ICMP_IDENT_L_P+2]=1; // seq number, low byte, we send only 1 ping at a time
@@ -704,6 +832,49 @@ void client_icmp_request(uint8_t *buf,uint8_t *destip)
 }
 #endif // PING_client
 
+#ifdef IGMP_client
+// eth and ip header of an igmp message to dip: the multicast mac of dip,
+// ttl 1 and the router alert option (rfc 2236). The igmp message itself
+// follows at IGMP_P.
+void make_ip_igmp_new(uint8_t *buf, const uint8_t *dip)
+{
+  uint16_t ck;
+  buf[ETH_DST_MAC]=0x01;
+  buf[ETH_DST_MAC+1]=0x00;
+  buf[ETH_DST_MAC+2]=0x5e;
+  buf[ETH_DST_MAC+3]=dip[1] & 0x7f;
+  buf[ETH_DST_MAC+4]=dip[2];
+  buf[ETH_DST_MAC+5]=dip[3];
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
+  buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
+  buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
+
+  buf[IP_P]=IP_V4_V | (IGMP_IP_HEADER_LEN/4);
+  buf[IP_TOS_P]=0;
+  buf[IP_TOTLEN_H_P]=0;
+  buf[IP_TOTLEN_L_P]=IGMP_IP_HEADER_LEN+IGMP_HEADER_LEN;
+  buf[IP_ID_H_P]=ip_identifier>>8;
+  buf[IP_ID_L_P]=ip_identifier & 0xff;
+  ip_identifier++;
+  buf[IP_FLAGS_P]=0;
+  buf[IP_FLAGS_P+1]=0;
+  buf[IP_TTL_P]=1;
+  buf[IP_PROTO_P]=IP_PROTO_IGMP_V;
+  buf[IP_CHECKSUM_P]=0;
+  buf[IP_CHECKSUM_P+1]=0;
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
+  memcpy(&buf[IP_DST_P], dip, 4);
+  // router alert
+  buf[IP_P+IP_HEADER_LEN]=0x94;
+  buf[IP_P+IP_HEADER_LEN+1]=0x04;
+  buf[IP_P+IP_HEADER_LEN+2]=0;
+  buf[IP_P+IP_HEADER_LEN+3]=0;
+  ck=checksum(&buf[IP_P], IGMP_IP_HEADER_LEN,0);
+  buf[IP_CHECKSUM_P]=ck>>8;
+  buf[IP_CHECKSUM_P+1]=ck & 0xff;
+}
+#endif // IGMP_client
+
 void __attribute__((weak)) ES_PingCallback(void)
 {
 }
@@ -716,8 +887,8 @@ void client_ntp_request(uint8_t *buf,uint8_t *ntpip,uint8_t srcport)
 {
   uint16_t ck;
   //
-  memcpy(&buf[ETH_DST_MAC], gwmacaddr, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_DST_MAC], ifc->gwmacaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
@@ -725,7 +896,7 @@ void client_ntp_request(uint8_t *buf,uint8_t *ntpip,uint8_t srcport)
   buf[IP_TOTLEN_L_P]=0x4c;
   buf[IP_PROTO_P]=IP_PROTO_UDP_V;
   memcpy(&buf[IP_DST_P], ntpip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
 
   buf[UDP_DST_PORT_H_P]=0;
@@ -778,8 +949,8 @@ uint8_t client_ntp_process_answer(uint8_t *buf,uint32_t *time,uint8_t dstport_l)
 // send_udp sends via gwip, you must call client_set_gwip at startup
 void send_udp_prepare(uint8_t *buf,uint16_t sport, uint8_t *dip, uint16_t dport)
 {
-  memcpy(&buf[ETH_DST_MAC], gwmacaddr, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_DST_MAC], ifc->gwmacaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
@@ -789,7 +960,7 @@ void send_udp_prepare(uint8_t *buf,uint16_t sport, uint8_t *dip, uint16_t dport)
   // done in transmit: buf[IP_TOTLEN_L_P]=IP_HEADER_LEN+UDP_HEADER_LEN+datalen;
   buf[IP_PROTO_P]=IP_PROTO_UDP_V;
   memcpy(&buf[IP_DST_P], dip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
 
   // done in transmit: fill_ip_hdr_checksum(buf);
   buf[UDP_DST_PORT_H_P]=(dport>>8);
@@ -807,7 +978,6 @@ void send_udp_prepare(uint8_t *buf,uint16_t sport, uint8_t *dip, uint16_t dport)
 
 void send_udp_transmit(uint8_t *buf,uint16_t datalen)
 {
-  uint16_t ck;
   buf[IP_TOTLEN_H_P]=(IP_HEADER_LEN+UDP_HEADER_LEN+datalen) >> 8;
   buf[IP_TOTLEN_L_P]=(IP_HEADER_LEN+UDP_HEADER_LEN+datalen) & 0xff;
   fill_ip_hdr_checksum(buf);
@@ -816,10 +986,7 @@ void send_udp_transmit(uint8_t *buf,uint16_t datalen)
   buf[UDP_LEN_L_P]=(UDP_HEADER_LEN+datalen) & 0xff;
 
   //
-  ck=checksum(&buf[IP_SRC_P], 16 + datalen,1);
-  buf[UDP_CHECKSUM_H_P]=ck>>8;
-  buf[UDP_CHECKSUM_L_P]=ck& 0xff;
-  enc28j60PacketSend(UDP_HEADER_LEN+IP_HEADER_LEN+ETH_HEADER_LEN+datalen,buf);
+  send_with_checksum(buf,16 + datalen,1,UDP_CHECKSUM_H_P,UDP_HEADER_LEN+IP_HEADER_LEN+ETH_HEADER_LEN+datalen);
 }
 
 void send_udp(uint8_t *buf,char *data,uint16_t datalen,uint16_t sport, uint8_t *dip, uint16_t dport)
@@ -849,14 +1016,14 @@ void send_wol(uint8_t *buf,uint8_t *wolmac)
   uint16_t ck;
   //
   memset(&buf[ETH_DST_MAC], 0xff, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
   
   buf[IP_TOTLEN_L_P]=0x82;
   buf[IP_PROTO_P]=IP_PROTO_UDP_V;
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   memset(&buf[IP_DST_P], 0xff, 4);
   fill_ip_hdr_checksum(buf);
   buf[UDP_DST_PORT_H_P]=0;
@@ -892,18 +1059,18 @@ void client_arp_whohas(uint8_t *buf,uint8_t *ip_we_search)
 {
   //
   memset(&buf[ETH_DST_MAC], 0xFF, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_ARP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_ARP_L_V;
   fill_buf_p(&buf[ETH_ARP_P],8,arpreqhdr);
   
-  memcpy(&buf[ETH_ARP_SRC_MAC_P], macaddr, 6);
+  memcpy(&buf[ETH_ARP_SRC_MAC_P], ifc->macaddr, 6);
   memset(&buf[ETH_ARP_DST_MAC_P], 0, 6);
 
   memcpy(&buf[ETH_ARP_DST_IP_P], ip_we_search, 4);
-  memcpy(&buf[ETH_ARP_SRC_IP_P], ipaddr, 4);
+  memcpy(&buf[ETH_ARP_SRC_IP_P], ifc->ipaddr, 4);
 
-  waitgwmac|=WGW_ACCEPT_ARP_REPLY;
+  ifc->waitgwmac|=WGW_ACCEPT_ARP_REPLY;
 
   // 0x2a=42=len of packet
   enc28j60PacketSend(0x2a,buf);
@@ -911,7 +1078,7 @@ void client_arp_whohas(uint8_t *buf,uint8_t *ip_we_search)
 
 uint8_t client_waiting_gw(void)
 {
-  if (waitgwmac & WGW_HAVE_GW_MAC){
+  if (ifc->waitgwmac & WGW_HAVE_GW_MAC){
     return(0);
   }
   return(1);
@@ -922,17 +1089,17 @@ uint8_t client_waiting_gw(void)
 // no len check here, you must first call eth_type_is_arp_and_my_ip
 uint8_t client_store_gw_mac(uint8_t *buf)
 {
-  if (memcmp(&buf[ETH_ARP_SRC_IP_P], gwip, 4)) {
+  if (memcmp(&buf[ETH_ARP_SRC_IP_P], ifc->gwip, 4)) {
     return 0;
   }
 
-  memcpy(gwmacaddr, &buf[ETH_ARP_SRC_MAC_P], 6);
+  memcpy(ifc->gwmacaddr, &buf[ETH_ARP_SRC_MAC_P], 6);
   return 1;
 }
 
 void client_gw_arp_refresh(void) {
-  if (waitgwmac & WGW_HAVE_GW_MAC){
-    waitgwmac|=WGW_REFRESHING;
+  if (ifc->waitgwmac & WGW_HAVE_GW_MAC){
+    ifc->waitgwmac|=WGW_REFRESHING;
   }
 }
 
@@ -950,8 +1117,8 @@ void client_set_wwwip(uint8_t *wwwipaddr)
 
 void client_set_gwip(uint8_t *gwipaddr)
 {
-  waitgwmac=WGW_INITIAL_ARP; // causes an arp request in the packet loop
-  memcpy(gwip, gwipaddr, 4);
+  ifc->waitgwmac=WGW_INITIAL_ARP; // causes an arp request in the packet loop
+  memcpy(ifc->gwip, gwipaddr, 4);
 }
 #endif
 
@@ -966,8 +1133,8 @@ void client_syn(uint8_t *buf,uint8_t srcport,uint8_t dstport_h,uint8_t dstport_l
 {
   uint16_t ck;
   // -- make the main part of the eth/IP/tcp header:
-  memcpy(&buf[ETH_DST_MAC], gwmacaddr, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_DST_MAC], ifc->gwmacaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
@@ -975,7 +1142,7 @@ void client_syn(uint8_t *buf,uint8_t srcport,uint8_t dstport_h,uint8_t dstport_l
   buf[IP_TOTLEN_L_P]=44; // good for syn
   buf[IP_PROTO_P]=IP_PROTO_TCP_V;
   memcpy(&buf[IP_DST_P], tcpsrvip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
 
   buf[TCP_DST_PORT_H_P]=dstport_h;
@@ -1027,8 +1194,8 @@ uint16_t build_tcp_data(uint8_t *buf, uint16_t srcPort )
 {
   uint16_t ck;
   // -- make the main part of the eth/IP/tcp header:
-  memcpy(&buf[ETH_DST_MAC], gwmacaddr, 6);
-  memcpy(&buf[ETH_SRC_MAC], macaddr, 6);
+  memcpy(&buf[ETH_DST_MAC], ifc->gwmacaddr, 6);
+  memcpy(&buf[ETH_SRC_MAC], ifc->macaddr, 6);
   buf[ETH_TYPE_H_P] = ETHTYPE_IP_H_V;
   buf[ETH_TYPE_L_P] = ETHTYPE_IP_L_V;
   fill_buf_p(&buf[IP_P],9,iphdr);
@@ -1036,7 +1203,7 @@ uint16_t build_tcp_data(uint8_t *buf, uint16_t srcPort )
   buf[IP_TOTLEN_L_P]=40; 
   buf[IP_PROTO_P]=IP_PROTO_TCP_V;
   memcpy(&buf[IP_DST_P], tcpsrvip, 4);
-  memcpy(&buf[IP_SRC_P], ipaddr, 4);
+  memcpy(&buf[IP_SRC_P], ifc->ipaddr, 4);
   fill_ip_hdr_checksum(buf);
   
   buf[TCP_DST_PORT_H_P]=tcp_client_port_h;
@@ -1096,14 +1263,8 @@ void send_tcp_data(uint8_t *buf,uint16_t dlen)
   buf[IP_TOTLEN_H_P]=j>>8;
   buf[IP_TOTLEN_L_P]=j& 0xff;
   fill_ip_hdr_checksum(buf);
-  // zero the checksum
-  buf[TCP_CHECKSUM_H_P]=0;
-  buf[TCP_CHECKSUM_L_P]=0;
   // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + data len
-  j=checksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+dlen,2);
-  buf[TCP_CHECKSUM_H_P]=j>>8;
-  buf[TCP_CHECKSUM_L_P]=j& 0xff;
-  enc28j60PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN,buf);
+  send_with_checksum(buf,8+TCP_HEADER_LEN_PLAIN+dlen,2,TCP_CHECKSUM_H_P,IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlen+ETH_HEADER_LEN);
 }
 
 
@@ -1293,6 +1454,76 @@ uint8_t packetloop_icmp_checkreply(uint8_t *buf,uint8_t *ip_monitoredhost)
 }
 #endif // PING_client
 
+// Broadcast and multicast frames that packetloop_icmp_tcp would ignore:
+// arp for other hosts, other ethernet types, ip not for us except dhcp
+// replies (they come before we have an address). Decided on the headers,
+// the rest of the frame is never read.
+static uint8_t packet_early_drop(uint8_t *buf, uint16_t plen, uint16_t rxstat)
+{
+  // pause and other MAC control frames
+  if (rxstat & ENC28J60_RXSTAT_CONTROL) {
+    return (1);
+  }
+  // unicast frames passed the mac filter, they are for us
+  if (!(rxstat & (ENC28J60_RXSTAT_BROADCAST|ENC28J60_RXSTAT_MULTICAST))) {
+    return (0);
+  }
+  if (buf[ETH_TYPE_H_P] == ETHTYPE_ARP_H_V && buf[ETH_TYPE_L_P] == ETHTYPE_ARP_L_V) {
+    return (!eth_type_is_arp_and_my_ip(buf, plen));
+  }
+  if (eth_type_is_ip_and_my_ip(buf, plen)) {
+    return (0);
+  }
+  if (plen >= UDP_DATA_P && buf[ETH_TYPE_H_P] == ETHTYPE_IP_H_V && buf[ETH_TYPE_L_P] == ETHTYPE_IP_L_V
+      && buf[IP_PROTO_P] == IP_PROTO_UDP_V && buf[UDP_DST_PORT_H_P] == 0 && buf[UDP_DST_PORT_L_P] == 68) {
+    return (0);
+  }
+  #ifdef IGMP_client
+  // queries and traffic of the groups we joined
+  if (igmp_wanted(buf, plen)) {
+    return (0);
+  }
+  #endif
+  return (1);
+}
+
+// Receive a packet like enc28j60PacketReceive, but answer arp requests and
+// pings without copying them to buf: only the headers are read and the
+// echo payload is moved to the transmit buffer inside the chip. Broadcasts
+// the stack has no use for are dropped after the headers.
+// Returns the length of any other packet, which is then in buf.
+uint16_t packet_receive_fastpath(uint8_t *buf, uint16_t maxlen) {
+  uint16_t plen;
+  plen = enc28j60RxHead(ICMP_DATA_P, buf);
+  if (plen == 0) {
+    return (0);
+  }
+  if (plen >= ICMP_DATA_P && eth_type_is_arp_and_my_ip(buf, plen) && buf[ETH_ARP_OPCODE_L_P] == ETH_ARP_OPCODE_REQ_L_V) {
+    enc28j60RxFinish();
+    make_arp_answer_from_request(buf);
+    return (0);
+  }
+  // small echo requests go the normal way, see ETHERNET_FASTPATH_MIN
+  if (plen >= ETHERNET_FASTPATH_MIN && eth_type_is_ip_and_my_ip(buf, plen) && buf[IP_PROTO_P] == IP_PROTO_ICMP_V && buf[ICMP_TYPE_P] == ICMP_TYPE_ECHOREQUEST_V) {
+    if (icmp_callback) {
+      ( * icmp_callback)( & (buf[IP_SRC_P]));
+    }
+    make_echo_reply_head(buf);
+    enc28j60PacketSendFromRx(ICMP_DATA_P, buf, ICMP_DATA_P, plen - ICMP_DATA_P);
+    enc28j60RxFinish();
+    ES_PingCallback();
+    return (0);
+  }
+  if (packet_early_drop(buf, plen, enc28j60RxStatus())) {
+    enc28j60RxFinish();
+    return (0);
+  }
+  // everything else goes the normal way
+  plen = enc28j60RxRest(ICMP_DATA_P, maxlen, buf);
+  enc28j60RxFinish();
+  return (plen);
+}
+
 // return 0 to just continue in the packet loop and return the position 
 // of the tcp/udp data if there is tcp/udp data part
 uint16_t packetloop_icmp_tcp(uint8_t * buf, uint16_t plen) {
@@ -1305,14 +1536,20 @@ uint16_t packetloop_icmp_tcp(uint8_t * buf, uint16_t plen) {
 
   //plen will be unequal to zero if there is a valid 
   // packet (without crc error):
+  #ifdef IGMP_client
+  if (plen == 0) {
+    // delayed membership reports
+    igmp_poll(buf);
+  }
+  #endif
   #if defined(NTP_client) || defined(UDP_client) || defined(TCP_client) || defined(PING_client)
   if (plen == 0) {
-    if ((waitgwmac & WGW_INITIAL_ARP || waitgwmac & WGW_REFRESHING) && delaycnt == 0 && enc28j60linkup()) {
-      client_arp_whohas(buf, gwip);
+    if ((ifc->waitgwmac & WGW_INITIAL_ARP || ifc->waitgwmac & WGW_REFRESHING) && ifc->delaycnt == 0 && enc28j60linkup()) {
+      client_arp_whohas(buf, ifc->gwip);
     }
-    delaycnt++;
+    ifc->delaycnt++;
     #if defined(TCP_client)
-    if (tcp_client_state == 1 && (waitgwmac & WGW_HAVE_GW_MAC)) { // send a syn
+    if (tcp_client_state == 1 && (ifc->waitgwmac & WGW_HAVE_GW_MAC)) { // send a syn
       tcp_client_state = 2;
       tcpclient_src_port_l++; // allocate a new port
       // we encode our 3 bit fd into the src port this
@@ -1333,16 +1570,25 @@ uint16_t packetloop_icmp_tcp(uint8_t * buf, uint16_t plen) {
       make_arp_answer_from_request(buf);
     }
     #if defined(NTP_client) || defined(UDP_client) || defined(TCP_client) || defined(PING_client)
-    if (waitgwmac & WGW_ACCEPT_ARP_REPLY && (buf[ETH_ARP_OPCODE_L_P] == ETH_ARP_OPCODE_REPLY_L_V)) {
+    if (ifc->waitgwmac & WGW_ACCEPT_ARP_REPLY && (buf[ETH_ARP_OPCODE_L_P] == ETH_ARP_OPCODE_REPLY_L_V)) {
       // is it an arp reply 
       if (client_store_gw_mac(buf)) {
-        waitgwmac = WGW_HAVE_GW_MAC;
+        ifc->waitgwmac = WGW_HAVE_GW_MAC;
       }
     }
     #endif // NTP_client||UDP_client||TCP_client||PING_client
     return (0);
 
   }
+  #ifdef IGMP_client
+  if (igmp_packet(buf, plen)) {
+    return (0);
+  }
+  // udp to a group we joined, drop out to have it processed elsewhere
+  if (igmp_wanted(buf, plen) && buf[IP_PROTO_P] == IP_PROTO_UDP_V) {
+    return (UDP_DATA_P);
+  }
+  #endif
   // check if ip packets are for us:
   if (eth_type_is_ip_and_my_ip(buf, plen) == 0) {
     return (0);
@@ -1548,7 +1794,7 @@ uint16_t packetloop_icmp_tcp(uint8_t * buf, uint16_t plen) {
   #endif // WWW_client||TCP_client
   //
   // tcp port web server start
-  if (buf[TCP_DST_PORT_H_P] == wwwport_h && buf[TCP_DST_PORT_L_P] == wwwport_l) {
+  if (buf[TCP_DST_PORT_H_P] == ifc->wwwport_h && buf[TCP_DST_PORT_L_P] == ifc->wwwport_l) {
     if (buf[TCP_FLAGS_P] & TCP_FLAGS_SYN_V) {
       make_tcp_synack_from_syn(buf);
       // make_tcp_synack_from_syn does already send the syn,ack